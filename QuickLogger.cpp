@@ -6,9 +6,19 @@
  */
 
 #include "QuickLogger.h"
+#include "QuickLoggerCodec.h"
 #include <string>
 #include <iostream>
-#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
 #include <ctime>
 #include <sys/time.h>
 #include <iomanip>
@@ -18,21 +28,58 @@
 #include <mutex>
 #include <chrono>
 #include <map>
-#include <queue>
 #include <unordered_map>
 #include <thread>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <sys/resource.h>
+#ifdef QL_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef QL_WITH_ZSTD
+#include <zstd.h>
+#endif
 
 using namespace std::chrono;
 
+// interned component and log level pair of a Channel
+struct QuickLogger::Channelentry {
+    Channelentry(const string & component, const string & loglevel, 
+                 unsigned int id) :
+        enabled(true), level(0), component(component), loglevel(loglevel),
+        id(id) { }
+    // level of the channel is enabled, or it is not defined
+    std::atomic<bool> enabled;
+    // id of loglevel, changes when Setloglevels defines it
+    std::atomic<unsigned int> level;
+    const string component;
+    const string loglevel;
+    // sequence number of the channel in its logger
+    const unsigned int id;
+};
+
 // Actual IMPLementation class 
 class QuickLogger::impl {
 public:
-    impl(string path, string name, string time_format, string rolloverperiod);
+    impl(string path, string name, string time_format, string rolloverperiod,
+         Format format);
     ~impl();
-    void Log(const string *message, 
-             const string *loglevel, 
-             const string *component);
+    // characters not owned by the message, not null terminated
+    struct Text{
+        Text() : data(""), size(0) { };
+        Text(const char * data) : data(data), size(strlen(data)) { };
+        Text(const char * data, size_t size) : data(data), size(size) { };
+        Text(const string & value) : data(value.data()), size(value.size()) { };
+        const char * data;
+        size_t size;
+    };
+    void Log(const Text & message, const Text & loglevel, 
+             const Text & component, 
+             std::initializer_list<Field> fields = {});
+    void Logformatted(int level, const char *format, 
+                      const char *arguments, size_t size);
     void Setloglevels(string levels);
     void Setfields(string fields);
     void Halt();
@@ -40,8 +87,29 @@ public:
     long Getbufferoverflows();
     string Getfilename();
     void Toggleloglevel(const string *level, const bool *enabled);
+    Channelentry * Getchannel(const string & component, 
+                              const string & loglevel);
+    void Logchannel(Channelentry * entry, const Text & message);
     void Setflushfrequency(unsigned int freq);
     void Setbuffersize(unsigned int size);
+    void Setbufferbytes(size_t bytes);
+    void Setthreadbuffers(bool enabled);
+    void Setbatching(unsigned int batchsize, bool flushonidle);
+    void Setsink(Sinktype type, bool directio, size_t chunksize);
+    void Setmaxfilesize(uint64_t bytes);
+    void Setmaxfiles(unsigned int files);
+    void Setcompression(Compression type, unsigned int ratelimit);
+    static void Setbackend(unsigned int workers);
+    void Setflushtrigger(unsigned int highwatermark, unsigned int spintime);
+    void Setoverflowpolicy(Overflow policy, unsigned int parameter, 
+                           const string & level);
+    Overflowcounters Getoverflowcounters(const string & level);
+    double Getwritesperdrain();
+    Stats Getstats();
+    void Setstatsreport(unsigned int interval);
+    // bit per level id in Levels, set if the level is enabled, read by the
+    // inline level checks of QuickLogger
+    std::atomic<uint64_t> levelmask;
 private:
     // variables
     // path where log file(s) will be stored
@@ -52,44 +120,648 @@ private:
     string time_format;
     // absolute filename
     string filename;
-    // order in which messages are written in the file
-    std::vector<int> fieldorder;
+    // output file format
+    Format format;
+    /**
+     * Time format compiled once into placeholders and literals. Everything
+     * but the microseconds is rendered once per second and cached, so
+     * formatting a timestamp within the same second is a copy of the cached
+     * text plus a few digits. Not thread-safe, each user owns its instance.
+     */
+    class Timeformat{
+    public:
+        /**
+         * @param format - Defines format of the time. 
+         *              Y - year 
+         *              M - month 
+         *              D - day
+         *              h - hour
+         *              m - minute
+         *              s - second
+         *              l - microseconds 
+         *      Any other character will be outputed as-is.
+         */
+        Timeformat(string format);
+        // appends formatted time to out
+        void Append(uint64_t timestamp, string & out);
+        // returns formatted time
+        string Format(uint64_t timestamp);
+    private:
+        // placeholder characters, 0 stands for literal text
+        std::vector<char> placeholders;
+        // literal text of each placeholder, empty for real placeholders
+        std::vector<string> literals;
+        // second the segments were rendered for
+        int64_t second;
+        // rendered text between the microsecond placeholders
+        std::vector<string> segments;
+        // renders the segments for the given second
+        void Render(time_t second);
+    };
+    // time format of the file names
+    Timeformat filenameformat;
+    // time format of the messages, used under _m_ofstream only
+    Timeformat messageformat;
+    // message timestamp rendered by SinkPipe, reused between messages
+    string timestamp;
+    // Logf message formatted by SinkPipe, reused between messages
+    string formatted;
+    /**
+     * Settings read by the flush thread. Setters never change the current
+     * snapshot, they publish a changed copy, so the flush thread reads it
+     * without any lock. Snapshots are read only by the flush thread and 
+     * under _m_ofstream, thus Drain frees the replaced ones at the start of
+     * each cycle, before it takes the current one into flushconfig.
+     */
+    struct Config{
+        Config() : fieldsversion(0), flushfrequency(10), 
+        batchsize(64 * 1024), flushonidle(true) { };
+        // order in which messages are written in the file
+        std::vector<int> fieldorder;
+        // incremented by Setfields, BINARY header is rewritten when it changes
+        unsigned long fieldsversion;
+        // how often flush buffer to disk
+        std::chrono::milliseconds flushfrequency;
+        // bytes collected before the batch is written
+        size_t batchsize;
+        // write partial batch at the end of each drain cycle
+        bool flushonidle;
+    };
+    std::atomic<const Config*> config;
+    // snapshot of the current drain cycle, used under _m_ofstream only
+    const Config * flushconfig;
+    // replaced snapshots, freed by the next drain cycle
+    std::vector<std::unique_ptr<const Config>> retiredconfigs;
+    // guards replacement of config and retiredconfigs
+    std::mutex _m_config;
+    // publishes a copy of the current config changed by update
+    template <typename F>
+    void Updateconfig(F update);
+    // frees the replaced snapshots and takes the current one, flush thread
+    // only, _m_ofstream must be held
+    void Refreshconfig();
+    // fieldsversion written in the last BINARY header
+    unsigned long headerfieldsversion;
     //available fields to be used
     std::map<string, int> availablefields;
-    // actual log levels
-    std::unordered_map<string, bool> loglevels;
+    /**
+     * Log levels and their ids, the id is the bit of the level in levelmask.
+     * Levels are never removed, thus the ids of QuickLogger::Level stay the
+     * same. Setloglevels publishes a new table, producers may still be using
+     * the old one, thus it is released only when the logger is destroyed.
+     */
+    struct Levels{
+        Levels() : serial(++serials) { }
+        Levels(const Levels & levels) : 
+            ids(levels.ids), names(levels.names), serial(++serials) { }
+        std::unordered_map<string, unsigned int> ids;
+        std::vector<string> names;
+        // unique among the tables of all loggers, keys the cache of 
+        // Maploglevel since an address could be reused by another logger
+        const unsigned long serial;
+        static std::atomic<unsigned long> serials;
+    };
+    static const unsigned int maxlevels = 64;
+    // levels of a thread mapped without hashing, see Maploglevel
+    static const unsigned int levelcache = 4;
+    std::atomic<const Levels*> levels;
+    std::vector<std::unique_ptr<const Levels>> retiredlevels;
+    // guards replacement of levels in Setloglevels
+    std::mutex _m_levels;
+    // channels by component and level, never removed since producers keep
+    // pointers to them
+    std::map<std::pair<string, string>, 
+             std::unique_ptr<Channelentry>> channels;
+    // guards channels, taken after _m_levels
+    std::mutex _m_channels;
+    // refreshes level ids and enabled flags of the channels
+    void Updatechannels();
     // log buffer size in messages
     unsigned int buffersize;
-    // how often flush buffer to disk
-    std::chrono::milliseconds flushfrequency;
+    // size of the arena of each buffer, 0 if it follows the buffer size
+    size_t bufferbytes;
+    // arena size of a buffer of size messages
+    size_t Arenasize(unsigned int size);
     // rollover period definition
     std::string rolloverperiod;
     // tm struct containing rollovertime. 00:00:00 by default
     std::tm rollovertime;
     // counter of buffer overflows
     std::atomic<long> bufferoverflowcount;
-    // current file handle
-    ofstream filehandle;
+    /**
+     * Destination of the staging buffer, owns the file descriptor. All calls
+     * are made under _m_ofstream.
+     */
+    class Sink{
+    public:
+        Sink() : syscalls(0) { };
+        virtual ~Sink() { };
+        // opens the file for appending, errors are written to stderr
+        virtual void Open(const string & filename) = 0;
+        // writes the data, could return before it reaches the file
+        virtual void Write(const char * data, size_t size) = 0;
+        // waits for the writes in flight and closes the file
+        virtual void Close() = 0;
+        // renames the open file, errors are written to stderr
+        bool Rename(const string & filename);
+        // system calls issued to write the data
+        std::atomic<long> syscalls;
+    protected:
+        string filename;
+    };
+    // writes the data with write(2) on the calling thread
+    class Filesink : public Sink{
+    public:
+        Filesink() : filedescriptor(-1) { };
+        ~Filesink() { this->Close(); };
+        void Open(const string & filename);
+        void Write(const char * data, size_t size);
+        void Close();
+    private:
+        int filedescriptor;
+    };
+    // minimal io_uring submission and completion queues, without liburing
+    class Uring{
+    public:
+        Uring() : ringfd(-1) { };
+        ~Uring();
+        // false if io_uring is not available
+        bool Setup(unsigned int entries);
+        // queues the write of iov at offset. Returns false on failure, the
+        // write is not queued then.
+        bool Submit(int fd, const iovec * iov, off_t offset, uint64_t tag);
+        // waits for a completion, returns its tag and result
+        bool Wait(uint64_t & tag, int & result);
+    private:
+        int ringfd;
+        unsigned * sqhead, * sqtail, * sqmask, * sqarray;
+        unsigned * cqhead, * cqtail, * cqmask;
+        io_uring_sqe * sqes;
+        io_uring_cqe * cqes;
+        void * sqring, * cqring;
+        size_t sqringsize, cqringsize, sqessize;
+    };
+    /**
+     * Writes page-aligned buffers asynchronously, through io_uring or, if it
+     * is not available, through a pool of pwrite threads. Data is copied to
+     * one of two buffers, so that the flush thread fills the next one while
+     * the previous is in flight. With directio the file is opened with 
+     * O_DIRECT and only whole pages are written. Partial page at the end is
+     * kept until more data arrives, and written padded at Close, after which
+     * the file is truncated to its real length.
+     */
+    class Asyncsink : public Sink{
+    public:
+        Asyncsink(bool directio);
+        ~Asyncsink();
+        void Open(const string & filename);
+        void Write(const char * data, size_t size);
+        void Close();
+    private:
+        static const size_t alignment = 4096;
+        struct Buffer{
+            char * data;
+            size_t capacity;
+            iovec iov;
+            // file offset of the write
+            off_t offset;
+            // tag of the write in flight, 0 if the buffer is free
+            uint64_t inflight;
+        };
+        Buffer buffers[2];
+        // buffer to be filled next
+        int next;
+        int filedescriptor;
+        bool directio;
+        // true if directio is requested and the file is opened with O_DIRECT
+        bool direct;
+        // file offset of the next write
+        off_t offset;
+        // O_DIRECT only: bytes of the last partial page, not written yet
+        string carry;
+        // tags of the writes, incremented with each submission
+        uint64_t lasttag;
+        Uring uring;
+        bool useuring;
+        // pwrite pool used without io_uring
+        std::vector<std::thread> workers;
+        std::deque<Buffer*> jobs;
+        std::mutex _m_jobs;
+        std::condition_variable jobsqueued;
+        std::condition_variable jobsdone;
+        bool workersstop;
+        void Worker();
+        // hands the buffer over to io_uring or the pool
+        void Submit(Buffer & buffer);
+        // waits until the buffer is written
+        void Wait(Buffer & buffer);
+        // writes remaining bytes synchronously
+        void Writesync(const char * data, size_t size, off_t offset);
+    };
+    /**
+     * Writes through a shared memory mapping of the file, without any copy
+     * into the kernel. File is extended by fallocate in chunks of chunksize
+     * bytes and mapped through a window which slides forward as it fills.
+     * Data copied to the window is in the page cache already, thus it 
+     * survives a crash of the process. Close truncates the file to the 
+     * length of the data, after a crash the file keeps zero padding up to
+     * the end of the chunk.
+     */
+    class Mmapsink : public Sink{
+    public:
+        Mmapsink(size_t chunksize);
+        ~Mmapsink() { this->Close(); };
+        void Open(const string & filename);
+        void Write(const char * data, size_t size);
+        void Close();
+    private:
+        static const size_t windowsize = 4 << 20;
+        size_t chunksize;
+        int filedescriptor;
+        // length of the data and of the allocated file
+        off_t length;
+        off_t allocated;
+        // current mapping and its file offset, window is null if not mapped
+        char * window;
+        off_t windowoffset;
+        size_t windowlength;
+        // maps the window containing offset, false on failure
+        bool Map(off_t offset);
+        void Unmap();
+    };
+    // kind of the sink, as set by Setsink
+    Sinktype sinktype;
+    bool directio;
+    // MMAP only: file is extended by chunks of this size
+    size_t chunksize;
+    // current sink, used under _m_ofstream only
+    std::unique_ptr<Sink> sink;
+    // creates sink of the current sinktype
+    void Createsink();
+    // new sink of the current sinktype, _m_ofstream must be held
+    Sink * Newsink();
+    // incremented by Setsink, so that a sink opened ahead of it is dropped
+    unsigned long sinkversion;
+    /**
+     * Next file, opened ahead by the rollover thread under a temporary name.
+     * Switchfile renames it and swaps it with the current sink, so that the
+     * flush thread never waits for a file to be opened. The old sink is 
+     * closed by the rollover thread. Used under _m_ofstream only.
+     */
+    std::unique_ptr<Sink> nextsink;
+    unsigned long nextsinkversion;
+    // sinks switched out and the names of their files, to be closed
+    std::vector<std::pair<std::unique_ptr<Sink>, string>> closingsinks;
+    // temporary name of the next file
+    string nextfilename;
+    // bytes written to the current file, rolls over at maxfilesize if set
+    std::atomic<uint64_t> filebytes;
+    std::atomic<uint64_t> maxfilesize;
+    // number of rolled over files kept, 0 keeps all
+    std::atomic<unsigned int> maxfiles;
+    // set if the current file was opened by a rollover, with the bytes of
+    // its BINARY header. Such a file is removed at shutdown if no message 
+    // was written to it, so that a rollover right before the end does not
+    // leave an empty file behind. Used under _m_ofstream only.
+    bool rolledfile;
+    uint64_t headerbytes;
+    // files rolled over by this logger, oldest first. Rollover thread only.
+    std::deque<string> rolledfiles;
+    // name of the last file without the extension and its number suffix
+    string lastfilebase;
+    unsigned int lastfilesequence;
+    // guards rolloverwork, rollover thread waits on rolloverwakeup
+    std::mutex _m_rollover;
+    std::condition_variable rolloverwakeup;
+    // set when the rollover thread has sinks to close or open
+    bool rolloverwork;
+    // streaming compressor of a rolled over file
+    class Encoder{
+    public:
+        virtual ~Encoder() { };
+        // appends compressed data to out, finishes the stream if last is set.
+        // Returns false on error.
+        virtual bool Compress(const char * data, size_t size, bool last,
+                              string & out) = 0;
+        // new encoder of the type, nullptr if it is not compiled in
+        static Encoder * Create(Compression type);
+    };
+#ifdef QL_WITH_ZLIB
+    class Gzipencoder : public Encoder{
+    public:
+        Gzipencoder();
+        ~Gzipencoder();
+        bool Compress(const char * data, size_t size, bool last, string & out);
+    private:
+        z_stream stream;
+        bool initialized;
+    };
+#endif
+#ifdef QL_WITH_ZSTD
+    class Zstdencoder : public Encoder{
+    public:
+        Zstdencoder();
+        ~Zstdencoder();
+        bool Compress(const char * data, size_t size, bool last, string & out);
+    private:
+        ZSTD_CCtx * context;
+    };
+#endif
+    // compression of the rolled over files and read rate in bytes per second
+    std::atomic<int> compression;
+    std::atomic<uint64_t> compressionrate;
+    // rolled over files waiting for compression, oldest first
+    std::deque<string> compressqueue;
+    // guards compressqueue, compress thread waits on compresswakeup
+    std::mutex _m_compress;
+    std::condition_variable compresswakeup;
+    // started by the first Setcompression
+    std::thread compress_thread;
+    // file name extension added by the compression
+    static const char * Compressedextension(Compression type);
+    // file name extension of the format
+    static const char * Fileextension(Format format);
+    // runs in separate thread, compresses the files of compressqueue
+    void Compressfiles();
+    // lowest CPU and I/O priority for the calling compression thread
+    static void Idlepriority();
+    // compresses the file and removes it, false if it failed or was stopped
+    bool Compressfile(const string & filename, Compression type);
+    /**
+     * Staging buffer. SinkPipe serializes messages here and the whole buffer
+     * is handed to the kernel with a single write, either when it reaches 
+     * batchsize or at the end of the drain cycle if flushonidle is set.
+     * Used under _m_ofstream only.
+     */
+    string output;
+    // write syscalls of the closed sinks
+    std::atomic<long> writecalls;
+    // drain cycles which wrote anything
+    std::atomic<long> writecycles;
+    // sink syscalls when the current drain cycle started, moved to the count
+    // of the new sink by Switchfile
+    long cyclewritecalls;
+    /**
+     * Counters of the producer threads, spread over statslots slots which 
+     * are not per thread: the n-th thread logging to any logger takes slot
+     * n % statslots, thus the threads share slots once there are more of 
+     * them than slots, or fewer live ones since exited threads keep their 
+     * numbers. Counters are atomic for that reason, the slots only keep 
+     * most logging calls off the same cache lines. Sums over all slots are
+     * exact.
+     */
+    struct Producerstats{
+        Producerstats();
+        // keeps the counters of the neighbouring slots apart
+        char padding[64];
+        std::atomic<long> enqueued;
+        std::atomic<long> enqueuelatency[Stats::buckets];
+        // logging calls using the ring, by the parity of their store epoch
+        std::atomic<long> storing[2];
+    };
+    static const unsigned int statslots = 16;
+    Producerstats producerstats[statslots];
+    // slot of the calling thread and the number of its Store calls
+    struct Threadstats{
+        Threadstats() : slot(statsthreads++ % statslots), calls(0) { };
+        unsigned int slot;
+        unsigned int calls;
+    };
+    static thread_local Threadstats threadstats;
+    static std::atomic<unsigned int> statsthreads;
+    // counters of the flush thread, see Stats
+    struct Flushstats{
+        Flushstats();
+        std::atomic<long> written;
+        std::atomic<long> bytes;
+        std::atomic<long> queuehighwatermark;
+        std::atomic<long> draintime[Stats::buckets];
+        std::atomic<long> rollovers;
+        std::atomic<long> rollovertime;
+        std::atomic<long> iocalls;
+        std::atomic<long> iotime;
+    };
+    Flushstats flushstats;
+    // histogram bucket of the duration
+    static int Bucket(std::chrono::steady_clock::duration duration);
+    // counts the rollover which started at start
+    void Countrollover(std::chrono::steady_clock::time_point start);
+    // seconds between the stats reports, 0 disables them
+    std::atomic<unsigned int> statsreport;
+    // time the next report is due, _m_ofstream must be held
+    std::chrono::steady_clock::time_point nextreport;
+    // writes the counters into the log, _m_ofstream must be held
+    void Reportstats();
     // internal message structure containing timestamp, log level, component 
-    // name and actual message itself.
+    // name and actual message itself. Texts point to the strings of the 
+    // caller until the message is stored, then to the arena of the buffer.
     struct M{
-        M(string t, string ll, string c, string m) :
-        timestamp(t), loglevel(ll), component(c), message(m) { };
-        string timestamp;
-        string loglevel;
-        string component;
-        string message;
+        M() : timestamp(0), level(maxlevels), channel(nullptr), 
+              format(nullptr) { };
+        // microseconds since the epoch, rendered by the flush thread
+        uint64_t timestamp;
+        // id of loglevel, maxlevels if the level is not defined
+        unsigned int level;
+        // channel of the message, its loglevel and component are not copied
+        // to the buffer
+        const Channelentry * channel;
+        Text loglevel;
+        Text component;
+        Text message;
+        // static format string of Logf, message is empty if set
+        const char * format;
+        // encoded arguments of Logf, formatted by the flush thread
+        Text arguments;
+        // key-value fields of Log, encoded as pairs of Logf arguments: the
+        // name string followed by the value
+        Text fields;
+    };
+    /**
+     * Bounded multi-producer/single-consumer ring buffer of message slots
+     * (after Dmitry Vyukov's sequence-slot queue), with the texts of the 
+     * messages packed into a preallocated arena of a fixed number of bytes.
+     * Storing a message does not allocate, and the memory of the buffer does
+     * not grow with the size of the messages.
+     * Slot and arena space are claimed together, by a single compare-and-swap
+     * of head which packs the position of the slot with the arena offset,
+     * thus records follow each other in the arena in the order of their 
+     * slots. With singleproducer set the compare-and-swap is replaced by a 
+     * plain store, which makes it a single-producer/single-consumer ring.
+     * Sequence of a slot tells whether the message at a position is 
+     * published (position + 1) or released (position + 2). Messages are 
+     * claimed with a compare-and-swap of claimpos, so that producers could
+     * drop the oldest message while the consumer is reading. Space is 
+     * returned in the order of the slots: released packs the position and
+     * the offset of the oldest message not released yet and is advanced by
+     * whoever finds it released.
+     */
+    class Ring{
+    public:
+        // slot capacity is rounded up to the power of two, limit is kept 
+        // as-is. Arena has exactly bytes.
+        Ring(unsigned int size, size_t bytes, bool singleproducer = false);
+        // copies the texts to the arena and publishes the message. Loglevel
+        // of a defined level is not copied, it points to the level table.
+        // Returns the number of messages in the buffer including this one,
+        // 0 if the buffer is full.
+        size_t Enqueue(const M & message);
+        // bytes of the arena taken by the message, at least one, see Fit
+        static size_t Recordsize(const M & message);
+        // claims up to max oldest messages with a single move of claimpos,
+        // returns their number, 0 if buffer is empty. Consumer only, each
+        // call has to be followed by Releasebatch.
+        size_t Claimbatch(size_t max);
+        // message i of the claimed batch. Consumer only.
+        M * Claimed(size_t i);
+        // releases the messages of the claimed batch before index count 
+        // which are not released yet, their slots and arena records are 
+        // reused by producers afterwards. Consumer only.
+        void Releaseclaimed(size_t count);
+        // releases the rest of the claimed batch. Consumer only.
+        void Releasebatch();
+        // drops the oldest message and returns its level id. False if there
+        // is no message to drop, or if dropping it would not free any space
+        // since the consumer did not release older messages yet.
+        bool Dropoldest(unsigned int & level);
+        // true while messages claimed by the consumer are not released
+        bool Claiming();
+        // maximum number of messages in the buffer
+        size_t Limit();
+        // size of the arena
+        size_t Bytes();
+        // changes the limit, returns false if it exceeds the capacity
+        bool Setlimit(unsigned int size);
+        // number of messages stored by producers but not claimed yet
+        size_t Pending();
+    private:
+        struct Slot{
+            std::atomic<uint32_t> sequence;
+            // arena offset following the record of the message
+            std::atomic<uint32_t> end;
+            M message;
+        };
+        std::vector<Slot> slots;
+        uint32_t mask;
+        std::unique_ptr<char[]> arena;
+        uint32_t arenasize;
+        bool singleproducer;
+        // maximum number of messages in flight, <= slots.size()
+        std::atomic<size_t> limit;
+        // producer and consumer positions are kept on separate cache lines
+        char pad0[64];
+        // position of the next slot << 32 | arena offset of the next record
+        std::atomic<uint64_t> head;
+        char pad1[64];
+        // position of the next message to claim
+        std::atomic<uint32_t> claimpos;
+        char pad2[64];
+        // position << 32 | arena offset of the oldest message not released
+        std::atomic<uint64_t> released;
+        char pad3[64];
+        // first position and size of the batch claimed by Claimbatch, and
+        // the number of its messages released already. Consumer only.
+        uint32_t claimed;
+        uint32_t claimedcount;
+        uint32_t claimedreleased;
+        // claims the oldest message, nullptr if it is not published
+        Slot * Claim(uint32_t & pos);
+        // marks the positions from pos released, advances released if it can
+        void Release(uint32_t pos, uint32_t count = 1);
+        // arena offset of a record of size bytes, given the offsets of the
+        // head and the oldest message. False if it does not fit.
+        bool Fit(uint32_t head, uint32_t tail, bool empty, uint32_t size, 
+                 uint32_t & start);
+        // copies text to out, advancing it
+        static Text Copy(char *& out, const Text & text);
     };
-    // primary buffer. Used most of the time
-    queue<M> primarybuffer;
-    // secondary buffer. Used only during flushing from the primary buffer.
-    queue<M> secondarybuffer;
-    // a swich to redirect the messages to secondary buffer.
-    // false - primary buffer used, true - secondary buffer used
-    std::atomic<bool> redirectflow;
-    // buffer mutex. Prevents two threads from writing messages at the same time
-    // because I was too lazy to implement lock free queue :)
+    // ring buffer messages are written to
+    std::atomic<Ring*> ring;
+    // ring replaced by Setbuffersize or Setbufferbytes, and the store epoch
+    // it was replaced in
+    struct Retiredring{
+        std::unique_ptr<Ring> ring;
+        unsigned long epoch;
+    };
+    // Producers which loaded the old pointer may still be writing into the
+    // retired rings, thus they are drained on each flush and released once
+    // they are empty and no producer of their epoch is left, see 
+    // Advancestoreepoch.
+    std::vector<Retiredring> retiredrings;
+    // producers count themselves into storing[storeepoch & 1] of their slot
+    // while they use the ring. Advanced by the flush thread only.
+    std::atomic<unsigned long> storeepoch;
+    // moves the replaced ring to retiredrings, under _m_buffer
+    void Retirering(Ring * buffer);
+    // starts the next store epoch if no producer of the previous one is 
+    // left, the rings retired before the current one are then out of the 
+    // producers' reach. Returns false if it has to wait.
+    bool Advancestoreepoch(unsigned long & epoch);
+    // buffer mutex. Guards replacement of the ring in Setbuffersize.
     std::mutex _m_buffer;
+    /**
+     * Staging buffer owned by a single producer thread. Used instead of the 
+     * shared ring when thread buffers are enabled, so that Log does not write
+     * to any cache line other threads write to.
+     */
+    struct Stage{
+        Stage(unsigned int size, size_t bytes) : 
+        buffer(size, bytes, true), orphaned(false), resized(false), 
+        closed(false) { };
+        Ring buffer;
+        // owner thread will not write to the stage anymore
+        std::atomic<bool> orphaned;
+        // stage is too small after Setbuffersize or Setbufferbytes, owner 
+        // should replace it
+        std::atomic<bool> resized;
+        // logger is halted, owner thread may release the stage
+        std::atomic<bool> closed;
+    };
+    // stages of the current thread, keyed by logger id. Marks all of them
+    // orphaned when the thread exits.
+    struct Threadstages{
+        Threadstages() : lastid(0), last(nullptr) { };
+        ~Threadstages();
+        std::unordered_map<unsigned long, std::shared_ptr<Stage>> stages;
+        // last looked up stage, spares the map lookup on the hot path
+        unsigned long lastid;
+        Stage * last;
+    };
+    static thread_local Threadstages threadstages;
+    // source of the unique logger ids. Addresses could be reused.
+    static std::atomic<unsigned long> instances;
+    // id of this logger, starts from 1
+    unsigned long id;
+    // true - messages are written to per-thread stages, false - to the ring
+    std::atomic<bool> threadbuffers;
+    // registered stages of all producer threads
+    std::vector<std::shared_ptr<Stage>> stages;
+    // incremented on each change of stages
+    std::atomic<unsigned long> stagesversion;
+    // stages mutex. Guards stages list, locked on registration only.
+    std::mutex _m_stages;
+    // flush thread's copy of stages, refreshed when stagesversion changes
+    std::vector<std::shared_ptr<Stage>> flushstages;
+    unsigned long flushstagesversion;
+    // buffer being drained and the message at its head
+    struct Source{
+        Ring * buffer;
+        M * head;
+        // messages to drain in the current cycle, not claimed yet
+        size_t remaining;
+        // size of the claimed batch and the index of its next message
+        size_t batch;
+        size_t index;
+    };
+    // most messages claimed from a buffer at once
+    static const size_t drainbatch = 128;
+    // producers get the space of the claimed messages back by this many,
+    // as soon as they are serialized, rather than once the batch is written
+    static const size_t drainrelease = 16;
+    // next message of the source, claiming the next batch once the current
+    // one is written. nullptr when the source is drained for this cycle.
+    M * Next(Source & source);
+    // all buffers drained by the current cycle, reused between the cycles
+    std::vector<Source> sources;
     // file handle mutex. Will be locked only during rollover.
     std::mutex _m_ofstream;
     // thread that actually writes messages to file
@@ -98,11 +770,54 @@ private:
     std::thread rollover_thread;
     // stop all threads and gracefully exit. false - don't stop, true - stop.
     std::atomic<bool> thread_stop;
+    /**
+     * State of the flush thread. Producers wake it from Parkedidle with the
+     * first message, and from Parked when their buffer reaches highwatermark.
+     * Waking is set by the producer which wakes it, so that only one of them
+     * takes _m_flush.
+     */
+    enum Flusherstate { Running, Parked, Parkedidle, Waking };
+    std::atomic<int> flusherstate;
+    // number of messages in a buffer which wakes the flush thread
+    std::atomic<size_t> highwatermark;
+    // microseconds the flush thread polls the buffers before it parks
+    std::atomic<unsigned int> spintime;
+    // guards wakeup, flush thread waits on flushwakeup
+    std::mutex _m_flush;
+    std::condition_variable flushwakeup;
+    bool wakeup;
+    /**
+     * Shared backend of the loggers constructed after Setbackend. Its worker
+     * threads drain the buffers of all registered loggers and its rollover 
+     * thread rolls over their files, in place of flush_thread and 
+     * rollover_thread of each logger.
+     */
+    class Engine;
+    struct Worker;
+    // engine set by Setbackend, null if loggers start their own threads
+    static std::shared_ptr<Engine> sharedengine;
+    static std::mutex _m_engine;
+    // engine of this logger and its worker draining the buffers, both null
+    // if the logger has its own threads
+    std::shared_ptr<Engine> engine;
+    Worker * worker;
+    // time the pending messages are due to be drained, worker only
+    std::chrono::steady_clock::time_point flushdue;
+    bool flushscheduled;
+    // drains the buffers if they are due, returns the time they are due 
+    // next, time_point::max() if they are empty. Worker only.
+    std::chrono::steady_clock::time_point Service(
+                                    std::chrono::steady_clock::time_point now);
+    // publishes the parked state before the worker sleeps, true if the 
+    // buffers need a drain right away
+    bool Parkworker();
     // possible timeframes for rollover period
     std::map<string, int> timeframes;
     //----------------------  methods  ------------------------------------
-    // returns time as a string in format YYYY-MM-DD HH:mm:ss.nanoseconds
-    string GetTime(std::string format = "YMD");
+    // returns current time in microseconds since the epoch
+    static uint64_t GetTime();
+    // writes value as exactly width decimal digits, zero padded
+    static void Writedigits(char * out, unsigned long value, int width);
     // sets up everything in the beginning
     void Initialize();
     // make string from something else
@@ -112,22 +827,128 @@ private:
     int Integerify(string);
     // runs in separate thread
     void Autorollover();
-    // maps the log level with defined ones and returns the id, if found
-    unsigned int Maploglevel(string level);
+    // parsed rolloverperiod and the time of the next rollover, used by the
+    // rollover thread only
+    pair<int, map<string, int>::iterator> rolloverrule;
+    std::chrono::system_clock::time_point rolloverdeadline;
+    bool rolloverstarted;
+    // computes the first deadline and opens the next file
+    void Startrollover();
+    // rolls over the file if the deadline passed, closes and opens sinks
+    void Rolloverstep();
+    // opens the next file unless it is open already, rollover thread only
+    void Preparenextfile();
+    // swaps the current sink with the next one, false if there is none. 
+    // _m_ofstream must be held.
+    bool Switchfile();
+    // closes the switched out sinks and removes the files over maxfiles
+    void Closesinks();
+    // wakes the rollover thread to close or open sinks
+    void Requestrollover();
+    // maps the log level with defined ones and returns the id, maxlevels if
+    // the level is not defined
+    unsigned int Maploglevel(const Text & level);
     //manages flushing to the disk - runs in separate thread
     void Flush();
-    // actually flushes messages to the disk
-    void SinkPipe(queue<M> * buffer);
+    // waits until the next drain is due
+    void Park();
+    // highwatermark, capped at the half of the buffer
+    size_t Highwatermark(Ring * buffer);
+    // wakes the flush thread in the given state, unless it is woken already
+    void Wakeflusher(int state);
+    // number of messages in all buffers
+    size_t Pendingmessages();
+    // updates flushstages if the stages changed
+    void Refreshstages();
+    // drains all buffers, merging them in timestamp order
+    void Drain();
+    // actually flushes message to the disk, _m_ofstream must be held
+    void SinkPipe(const M * message);
+    // stage of the calling thread, registered on first use
+    Stage * Getstage();
+    // stores message in the buffer of the calling thread, applying the 
+    // overflow policy of its level
+    void Store(const M & message);
+    /**
+     * Overflow policy and counters of a log level. Counters are kept for the
+     * lifetime of the logger, unlike bufferoverflowcount.
+     */
+    struct Levelpolicy{
+        Levelpolicy() : policy((int)Overflow::DROPNEWEST), parameter(0), 
+        overflows(0), sampled(0), blockedtime(0) { };
+        std::atomic<int> policy;
+        // timeout, spin time or sampling threshold, see Setoverflowpolicy
+        std::atomic<unsigned int> parameter;
+        std::atomic<long> overflows;
+        std::atomic<long> sampled;
+        // nanoseconds spent waiting for space in the buffer
+        std::atomic<long> blockedtime;
+    };
+    // indexed by level id, the last one is used by undefined levels
+    Levelpolicy levelpolicies[maxlevels + 1];
+    // retries storing the message into the full buffer, as the policy says.
+    // Returns the result of the successful Enqueue, 0 if it failed.
+    size_t Retry(Ring * buffer, Overflow overflow, Levelpolicy & policy, 
+                 const M & message);
+    // drops the oldest messages while it frees space, until the message 
+    // fits. Returns the result of Enqueue, 0 if it did not fit.
+    size_t Replaceoldest(Ring * buffer, const M & message);
+    // decides if the message is kept under the SAMPLE policy
+    static bool Sample(Ring * buffer, unsigned int threshold);
+    // producers waiting for space in the buffers, flush thread does not park
+    // while there are any
+    std::atomic<int> waitingproducers;
+    // producers with BLOCK or DROPOLDEST wait on spaceready, notified after
+    // drains
+    std::mutex _m_space;
+    std::condition_variable spaceready;
+    // names of the default log levels, indexed by QuickLogger::Level
+    static const char * levelnames[];
+    // ids of the BINARY format, assigned by SinkPipe
+    std::unordered_map<string, uint64_t> levelids;
+    std::unordered_map<string, uint64_t> componentids;
+    std::unordered_map<const char*, uint64_t> formatids;
+    // key of the lookups in levelids and componentids, keeps its capacity
+    string internkey;
+    // BINARY level and component ids of each channel, by channel id
+    std::vector<std::pair<uint64_t, uint64_t>> channelids;
+    // timestamp of the previous BINARY record, 0 at the head of the file
+    uint64_t lasttimestamp;
+    // opens the file, writes BINARY header
+    void Openfile();
+    // writes the staging buffer to the file and closes it
+    void Closefile();
+    // hands the staging buffer to the kernel
+    void Writeout();
+    // writes BINARY header and definitions of all known ids
+    void Writeheader();
+    // appends BINARY message to the output, defining new ids first
+    void Encodemessage(const M * message);
+    // appends JSONL object of the message to the output
+    void Encodejson(const M * message);
+    // number of bytes needed to encode the fields of Log
+    static size_t Fieldsize(std::initializer_list<Field> fields);
+    // encodes the fields of Log to out
+    static void Encodefields(char * out, std::initializer_list<Field> fields);
+    // id of the string, appends definition to the output if it is new
+    template <typename K>
+    uint64_t Intern(std::unordered_map<K, uint64_t> & ids, const K & key,
+                    QuickLoggerCodec::Record definition, 
+                    const char * value, size_t size);
     //defines available timeframe keywords
     void Initializetimeframes();
-    //calculates seconds till the next rollover
-    std::chrono::seconds Calculaterolloverperiod(pair<int, map<string, int>::iterator> p);
+    //calculates time of the rollover after the previous one
+    std::chrono::system_clock::time_point Calculaterollovertime(
+                                pair<int, map<string, int>::iterator> p,
+                                std::chrono::system_clock::time_point previous);
     //parses rollover period defined by string
     std::pair<int, std::map<string, int>::iterator> Parserolloverperiod();
     /**
      * Generates filename and stores it in filename string
      */
     void Generatefilename();
+    // name of a new file, suffixed with a number if the name is taken
+    string Uniquefilename();
     /**
      * Directly store a message to the current file. Not-buffered.
      * Will lock ofstream mutex. 
@@ -136,29 +957,139 @@ private:
      */
     void DirectLog(string message); 
 };
+// flush thread of the engine, drains the buffers of its loggers
+struct QuickLogger::impl::Worker{
+    Worker() : wakeup(false) { };
+    std::thread thread;
+    // guards loggers, held by the worker except while it sleeps
+    std::mutex _m_loggers;
+    std::vector<impl*> loggers;
+    // guards wakeup, the worker waits on wakeupcv
+    std::mutex _m_wakeup;
+    std::condition_variable wakeupcv;
+    bool wakeup;
+};
+//--------------------------------------------------------------------------
+class QuickLogger::impl::Engine{
+public:
+    Engine(unsigned int workers);
+    ~Engine();
+    // adds the logger to the least loaded worker and to the rollover thread
+    void Register(impl * logger);
+    // removes the logger, the engine does not touch it after the return
+    void Unregister(impl * logger);
+    void Wake(Worker * worker);
+    void Wakerollover();
+    // queues a rolled over file of the logger, starts the compress thread
+    void Compress(impl * logger, const string & filename);
+private:
+    // runs in separate thread, one per worker
+    void Work(Worker * worker);
+    // runs in separate thread, rolls over the files of all loggers
+    void Rollover();
+    // runs in separate thread, compresses the files of all loggers one by
+    // one, each with the compression and rate of its logger
+    void Compressfiles();
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::thread rollover_thread;
+    // guards loggers, held by the rollover thread except while it sleeps
+    std::mutex _m_loggers;
+    std::vector<impl*> loggers;
+    // guards rolloverwakeup, the rollover thread waits on rolloverwakeupcv
+    std::mutex _m_rollover;
+    std::condition_variable rolloverwakeupcv;
+    bool rolloverwakeup;
+    // started by the first Compress
+    std::thread compress_thread;
+    // guards the compression state, its threads wait on compresswakeup
+    std::mutex _m_compress;
+    std::condition_variable compresswakeup;
+    std::deque<std::pair<impl*, string>> compressqueue;
+    // logger of the file being compressed, Unregister waits until it is done
+    impl * compressing;
+    std::atomic<bool> stop;
+};
 //--------------------------------------------------------------------------
 //Interface wrapper
 QuickLogger::QuickLogger(string path, string name, string time_format, string rolloverperiod) : 
-        PrivateImpl( new impl(path, name, time_format, rolloverperiod)) { }
+        QuickLogger(path, name, time_format, rolloverperiod, Format::CSV) { }
+//--------------------------------------------------------------------------
+QuickLogger::QuickLogger(string path, string name, string time_format, string rolloverperiod,
+                         Format format) : 
+        PrivateImpl( new impl(path, name, time_format, rolloverperiod, 
+                              format)),
+        levelmask(&PrivateImpl->levelmask) { }
 // Actual constructor
-QuickLogger::impl::impl(string path, string name, string time_format, string rolloverperiod) :
+QuickLogger::impl::impl(string path, string name, string time_format, string rolloverperiod,
+                        Format format) :
         // initialization list
+        levelmask(0),
         path(path),
         name(name),
         time_format(time_format),
+        format(format),
+        filenameformat(time_format),
+        messageformat("Y-M-D h:m:s.l"),
+        config(new Config()),
+        flushconfig(nullptr),
+        headerfieldsversion(0),
+        levels(new Levels()),
         rolloverperiod(rolloverperiod),
-        flushfrequency(10),
+        bufferoverflowcount(0),
+        sinktype(Sinktype::WRITE),
+        directio(false),
+        chunksize(16 << 20),
+        sinkversion(0),
+        nextsinkversion(0),
+        filebytes(0),
+        maxfilesize(0),
+        maxfiles(0),
+        rolledfile(false),
+        headerbytes(0),
+        lastfilesequence(0),
+        rolloverwork(false),
+        compression((int)Compression::NONE),
+        compressionrate(0),
+        writecalls(0),
+        writecycles(0),
+        cyclewritecalls(0),
+        statsreport(0),
+        ring(nullptr),
+        storeepoch(0),
+        id(++instances),
+        threadbuffers(false),
+        stagesversion(0),
+        flushstagesversion(0),
         thread_stop(false),
-        redirectflow(false),
-        bufferoverflowcount(0)
+        flusherstate(Running),
+        highwatermark(500),
+        spintime(0),
+        wakeup(false),
+        worker(nullptr),
+        flushscheduled(false),
+        rolloverstarted(false),
+        waitingproducers(0),
+        lasttimestamp(0)
 {
     this->Generatefilename(); 
     this->Initialize();
 }
 //--------------------------------------------------------------------------
+thread_local QuickLogger::impl::Threadstages QuickLogger::impl::threadstages;
+std::atomic<unsigned long> QuickLogger::impl::instances(0);
+const size_t QuickLogger::impl::drainbatch;
+const size_t QuickLogger::impl::drainrelease;
+std::atomic<unsigned long> QuickLogger::impl::Levels::serials(0);
+std::shared_ptr<QuickLogger::impl::Engine> QuickLogger::impl::sharedengine;
+thread_local QuickLogger::impl::Threadstats QuickLogger::impl::threadstats;
+std::atomic<unsigned int> QuickLogger::impl::statsthreads(0);
+std::mutex QuickLogger::impl::_m_engine;
+//--------------------------------------------------------------------------
 //Actual destructor
 QuickLogger::impl::~impl(){
-    
+    delete this->ring.load();
+    delete this->levels.load();
+    delete this->config.load();
 }
 //--------------------------------------------------------------------------
 QuickLogger::~QuickLogger() {
@@ -174,15 +1105,6 @@ string QuickLogger::impl::stringify(T x){
 }
 //--------------------------------------------------------------------------
 void QuickLogger::impl::Initialize(){
-    // open log file, append if already exists
-    // throws, not properly initialized if so.
-    try{
-        this->filehandle.open(this->filename.c_str(), ios::app);
-    }
-    catch(std::ofstream::failure e){
-        cerr << "Failed to open file " + 
-                this->filename + ": " + string(e.what()) << endl;
-    }
     // available log fields
     availablefields.insert(pair<string, int>("TIME",            0));
     availablefields.insert(pair<string, int>("LEVEL",           1));
@@ -194,6 +1116,15 @@ void QuickLogger::impl::Initialize(){
     this->Setfields("TIME,LEVEL,COMPONENT,MESSAGE");
     // default buffer size
     this->buffersize = 1000;
+    this->flushconfig = this->config.load();
+    this->output.reserve(this->flushconfig->batchsize);
+    this->Createsink();
+    // open log file, append if already exists. BINARY header is written
+    // with the field order, thus it is opened after the fields are set.
+    this->Openfile();
+    this->bufferbytes = 0;
+    this->ring.store(new Ring(this->buffersize, 
+                              this->Arenasize(this->buffersize)));
     /***************************** Time-Frames ********************************/
     //with multiplier
     timeframes.insert(pair<string, int>("second",   0));
@@ -216,212 +1147,2442 @@ void QuickLogger::impl::Initialize(){
     this->rollovertime.tm_hour = 0;
     this->rollovertime.tm_min = 0;
     this->rollovertime.tm_sec = 0;
+    {
+        std::lock_guard<std::mutex> lock(_m_engine);
+        this->engine = sharedengine;
+    }
+    if(this->engine){
+        this->engine->Register(this);
+        return;
+    }
     this->flush_thread = std::thread(&QuickLogger::impl::Flush, this);
     //this->flush_thread.detach();
     this->rollover_thread = std::thread(&QuickLogger::impl::Autorollover, this);
     //this->rollover_thread.detach();
 }
 //--------------------------------------------------------------------------
-void QuickLogger::Log(string message, string loglevel, string component){
-    this->PrivateImpl->Log( &message, &loglevel, &component);
+void QuickLogger::Log(const string & message, const string & loglevel, 
+                      const string & component){
+    this->PrivateImpl->Log(message, loglevel, component);
+}
+//--------------------------------------------------------------------------
+#if defined(__GNUC__) && defined(__ELF__) && defined(__GLIBCXX__)
+/**
+ * Log(string, string, string) of the first releases, arguments by value.
+ * Callers would find it ambiguous with the overloads taking references, thus
+ * it is not declared by the header, but it is still exported under the 
+ * mangled name of the member for the binaries built against those releases.
+ * Arguments by value are passed by reference to copies made by the caller,
+ * the same as for a free function taking the object first.
+ */
+#if _GLIBCXX_USE_CXX11_ABI
+#define QL_LOG_BY_VALUE "_ZN11QuickLogger3LogENSt7__cxx1112basic_string" \
+                        "IcSt11char_traitsIcESaIcEEES5_S5_"
+#else
+#define QL_LOG_BY_VALUE "_ZN11QuickLogger3LogESsSsSs"
+#endif
+void Logbyvalue(QuickLogger * logger, string message, string loglevel, 
+                string component) __asm__(QL_LOG_BY_VALUE);
+void Logbyvalue(QuickLogger * logger, string message, string loglevel, 
+                string component){
+    logger->Log(message, loglevel, component);
+}
+#endif
+//--------------------------------------------------------------------------
+void QuickLogger::Log(const char * message, const char * loglevel, 
+                      const char * component){
+    this->PrivateImpl->Log(message, loglevel, component);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::Log(const string & message, const string & loglevel, 
+                      const string & component, 
+                      std::initializer_list<Field> fields){
+    this->PrivateImpl->Log(message, loglevel, component, fields);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::Log(const char * message, const char * loglevel, 
+                      const char * component, 
+                      std::initializer_list<Field> fields){
+    this->PrivateImpl->Log(message, loglevel, component, fields);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::Logtext(const char * message, size_t messagesize,
+                          const char * loglevel, size_t loglevelsize,
+                          const char * component, size_t componentsize,
+                          std::initializer_list<Field> fields){
+    this->PrivateImpl->Log(impl::Text(message, messagesize),
+                           impl::Text(loglevel, loglevelsize),
+                           impl::Text(component, componentsize), fields);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Log(const Text & message, const Text & loglevel, 
+                            const Text & component, 
+                            std::initializer_list<Field> fields){
+    // messages of unknown levels are always written
+    unsigned int level = this->Maploglevel(loglevel);
+    if(level < maxlevels && 
+       (this->levelmask.load(std::memory_order_relaxed) & (1ull << level)) == 0)
+        return;
+    M m;
+    m.timestamp = GetTime();
+    m.level = level;
+    // names of the defined levels stay valid, they are not copied
+    m.loglevel = (level < maxlevels) ? 
+                 Text(this->levels.load(std::memory_order_acquire)->names[level]) :
+                 loglevel;
+    m.component = component;
+    m.message = message;
+    if(fields.size() == 0){
+        this->Store(m);
+        return;
+    }
+    // fields are encoded on the stack unless they are too big, as the
+    // arguments of Logf
+    char stack[256];
+    size_t size = Fieldsize(fields);
+    std::unique_ptr<char[]> heap;
+    char * encoded = stack;
+    if(size > sizeof(stack)){
+        heap.reset(new char[size]);
+        encoded = heap.get();
+    }
+    Encodefields(encoded, fields);
+    m.fields = Text(encoded, size);
+    this->Store(m);
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Fieldsize(std::initializer_list<Field> fields){
+    size_t size = 0;
+    for(auto i = fields.begin(); i != fields.end(); i++){
+        size += 1 + sizeof(uint32_t) + (*i).namesize;
+        switch((*i).tag){
+            case Argbool:
+            case Argchar:
+                size += 2;
+                break;
+            case Argstring:
+                size += 1 + sizeof(uint32_t) + (*i).textsize;
+                break;
+            default:
+                size += 1 + 8;
+        }
+    }
+    return size;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Encodefields(char * out, 
+                                     std::initializer_list<Field> fields){
+    for(auto i = fields.begin(); i != fields.end(); i++){
+        uint32_t size = (*i).namesize;
+        *out++ = Argstring;
+        memcpy(out, &size, sizeof(size));
+        memcpy(out + sizeof(size), (*i).name, size);
+        out += sizeof(size) + size;
+        *out++ = (*i).tag;
+        switch((*i).tag){
+            case Argbool:
+            case Argchar:
+                *out++ = (*i).value.c;
+                break;
+            case Argstring:
+                size = (*i).textsize;
+                memcpy(out, &size, sizeof(size));
+                memcpy(out + sizeof(size), (*i).text, size);
+                out += sizeof(size) + size;
+                break;
+            default:
+                // all the numbers are 8 bytes
+                memcpy(out, &(*i).value, 8);
+                out += 8;
+        }
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::Logchannel(Channelentry * entry, const char * message, 
+                             size_t size){
+    this->PrivateImpl->Logchannel(entry, impl::Text(message, size));
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Logchannel(Channelentry * entry, const Text & message){
+    M m;
+    m.timestamp = GetTime();
+    m.level = entry->level.load(std::memory_order_relaxed);
+    m.channel = entry;
+    m.loglevel = entry->loglevel;
+    m.component = entry->component;
+    m.message = message;
+    this->Store(m);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::Logformatted(Level level, const char * format, 
+                               const char * arguments, size_t size){
+    this->PrivateImpl->Logformatted((int)level, format, arguments, size);
+}
+//--------------------------------------------------------------------------
+const char * QuickLogger::impl::levelnames[] = {
+    "FATAL", "ERROR", "WARNING", "INFO", "DEBUG"
+};
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Logformatted(int level, const char * format, 
+                                     const char * arguments, size_t size){
+    M m;
+    m.timestamp = GetTime();
+    m.level = level;
+    m.loglevel = levelnames[level];
+    m.format = format;
+    m.arguments = Text(arguments, size);
+    this->Store(m);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Store(const M & message){
+    Threadstats & thread = threadstats;
+    Producerstats & stats = this->producerstats[thread.slot];
+    bool timed = (thread.calls++ % 64) == 0;
+    steady_clock::time_point start;
+    if(timed)
+        start = steady_clock::now();
+    Ring * buffer;
+    std::atomic<long> * storing = nullptr;
+    if(this->threadbuffers.load(std::memory_order_relaxed))
+        buffer = &this->Getstage()->buffer;
+    else{
+        // counted before the ring is loaded, see Advancestoreepoch
+        storing = &stats.storing[this->storeepoch.load() & 1];
+        storing->fetch_add(1);
+        buffer = this->ring.load();
+    }
+    Levelpolicy & policy = this->levelpolicies[message.level];
+    Overflow overflow = (Overflow)policy.policy.load(std::memory_order_relaxed);
+    if(overflow == Overflow::SAMPLE && 
+       !Sample(buffer, policy.parameter.load(std::memory_order_relaxed))){
+        policy.sampled++;
+        if(storing != nullptr)
+            storing->fetch_sub(1, std::memory_order_release);
+        return;
+    }
+    size_t pending = buffer->Enqueue(message);
+    // message larger than the whole arena is dropped right away
+    if(pending == 0 && overflow != Overflow::DROPNEWEST && 
+       overflow != Overflow::SAMPLE && 
+       Ring::Recordsize(message) <= buffer->Bytes())
+        pending = this->Retry(buffer, overflow, policy, message);
+    if(pending == 0){
+        policy.overflows++;
+        this->bufferoverflowcount++;
+    }
+    else
+        stats.enqueued.fetch_add(1, std::memory_order_relaxed);
+    if(timed)
+        stats.enqueuelatency[Bucket(steady_clock::now() - start)].fetch_add(
+                                                1, std::memory_order_relaxed);
+    // parked flush thread is woken by the first message, or when the buffer
+    // reaches the high-water mark or overflows
+    int state = this->flusherstate.load(std::memory_order_seq_cst);
+    if(state == Parkedidle || (state == Parked && 
+       (pending == 0 || pending >= this->Highwatermark(buffer))))
+        this->Wakeflusher(state);
+    if(storing != nullptr)
+        storing->fetch_sub(1, std::memory_order_release);
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Retry(Ring * buffer, Overflow overflow, 
+                                Levelpolicy & policy, const M & message){
+    size_t pending = 0;
+    unsigned int parameter = policy.parameter.load(std::memory_order_relaxed);
+    if(overflow == Overflow::DROPOLDEST){
+        pending = this->Replaceoldest(buffer, message);
+        // messages claimed by the flush thread keep their space until they
+        // are released, it is waited for the same way as BLOCK does
+        if(pending != 0 || !buffer->Claiming())
+            return pending;
+    }
+    // flush thread makes the space, it does not park until this returns
+    this->waitingproducers++;
+    int state = this->flusherstate.load(std::memory_order_seq_cst);
+    if(state == Parked || state == Parkedidle)
+        this->Wakeflusher(state);
+    auto start = std::chrono::steady_clock::now();
+    if(overflow == Overflow::SPIN){
+        auto end = start + std::chrono::nanoseconds(parameter > 0 ? 
+                                                    parameter : 10000);
+        while((pending = buffer->Enqueue(message)) == 0 && 
+              std::chrono::steady_clock::now() < end)
+            std::this_thread::yield();
+    }
+    else{
+        auto deadline = start + std::chrono::microseconds(parameter > 0 ? 
+                                                          parameter : 1000);
+        std::unique_lock<std::mutex> lock(_m_space);
+        this->spaceready.wait_until(lock, deadline, [&]{
+            pending = (overflow == Overflow::DROPOLDEST) ? 
+                      this->Replaceoldest(buffer, message) : 
+                      buffer->Enqueue(message);
+            return pending != 0 || this->thread_stop;
+        });
+    }
+    this->waitingproducers--;
+    policy.blockedtime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start).count();
+    return pending;
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Replaceoldest(Ring * buffer, const M & message){
+    size_t pending = 0;
+    unsigned int dropped;
+    // dropped message is counted on its own level. Another producer could
+    // take the freed space, thus it is retried.
+    while(pending == 0 && buffer->Dropoldest(dropped)){
+        this->levelpolicies[dropped].overflows++;
+        this->bufferoverflowcount++;
+        pending = buffer->Enqueue(message);
+    }
+    return pending;
+}
+//--------------------------------------------------------------------------
+/**
+ * Keeps every message while the buffer is filled up to threshold percent.
+ * Above it the chance to keep the message falls linearly with the free 
+ * space, down to 0 when the buffer is full.
+ */
+bool QuickLogger::impl::Sample(Ring * buffer, unsigned int threshold){
+    static thread_local uint64_t random = 
+        std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    size_t limit = buffer->Limit();
+    size_t pending = buffer->Pending();
+    size_t start = limit * ((threshold > 0 && threshold < 100) ? 
+                            threshold : 50) / 100;
+    if(pending <= start)
+        return true;
+    if(pending >= limit)
+        return false;
+    // xorshift64
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    return random % (limit - start) < limit - pending;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Stage * QuickLogger::impl::Getstage(){
+    Threadstages & ts = threadstages;
+    if(ts.lastid != this->id){
+        auto p = ts.stages.find(this->id);
+        ts.last = (p != ts.stages.end()) ? (*p).second.get() : nullptr;
+        ts.lastid = this->id;
+    }
+    if(ts.last != nullptr && !ts.last->resized.load(std::memory_order_relaxed))
+        return ts.last;
+    // stage is too small, hand it over to the flush thread 
+    if(ts.last != nullptr){
+        ts.last->orphaned.store(true, std::memory_order_release);
+        ts.stages.erase(this->id);
+    }
+    // release stages of the loggers which are gone
+    for(auto i = ts.stages.begin(); i != ts.stages.end(); ){
+        if((*i).second->closed.load(std::memory_order_relaxed))
+            i = ts.stages.erase(i);
+        else
+            i++;
+    }
+    std::shared_ptr<Stage> stage;
+    {
+        std::lock_guard<std::mutex> lock(_m_stages);
+        stage = std::make_shared<Stage>(this->buffersize, 
+                                        this->Arenasize(this->buffersize));
+        this->stages.push_back(stage);
+        this->stagesversion++;
+    }
+    ts.stages[this->id] = stage;
+    ts.last = stage.get();
+    return ts.last;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Threadstages::~Threadstages(){
+    for(auto i = this->stages.begin(); i != this->stages.end(); i++)
+        (*i).second->orphaned.store(true, std::memory_order_release);
+}
+//--------------------------------------------------------------------------
+uint64_t QuickLogger::impl::GetTime(){
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Writedigits(char * out, unsigned long value, 
+                                    int width){
+    static const char pairs[] = 
+        "00010203040506070809101112131415161718192021222324252627282930313233"
+        "34353637383940414243444546474849505152535455565758596061626364656667"
+        "6869707172737475767778798081828384858687888990919293949596979899";
+    // two digits at a time, from the end
+    while(width >= 2){
+        unsigned long p = (value % 100) * 2;
+        value /= 100;
+        out[--width] = pairs[p + 1];
+        out[--width] = pairs[p];
+    }
+    if(width == 1)
+        out[0] = '0' + value % 10;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Timeformat::Timeformat(string format) :
+        second(-1)
+{
+    for(auto it = format.begin(); it != format.end(); it++){
+        switch(*it){
+            case 'Y':
+            case 'M':
+            case 'D':
+            case 'h':
+            case 'm':
+            case 's':
+            case 'l':
+                this->placeholders.push_back(*it);
+                this->literals.push_back("");
+                break;
+            default :
+                // consecutive literal characters are merged
+                if(this->placeholders.empty() || this->placeholders.back() != 0){
+                    this->placeholders.push_back(0);
+                    this->literals.push_back("");
+                }
+                this->literals.back() += *it;
+                break;
+        }
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Timeformat::Render(time_t second){
+    tm now;
+    char digits[4];
+    localtime_r(&second, &now);
+    this->segments.assign(1, "");
+    for(size_t i = 0; i < this->placeholders.size(); i++){
+        string & segment = this->segments.back();
+        switch(this->placeholders[i]){
+            case 'Y':
+                Writedigits(digits, now.tm_year + 1900, 4);
+                segment.append(digits, 4);
+                break;
+            case 'M':
+                Writedigits(digits, now.tm_mon + 1, 2);
+                segment.append(digits, 2);
+                break;
+            case 'D':
+                Writedigits(digits, now.tm_mday, 2);
+                segment.append(digits, 2);
+                break;
+            case 'h':
+                Writedigits(digits, now.tm_hour, 2);
+                segment.append(digits, 2);
+                break;
+            case 'm':
+                Writedigits(digits, now.tm_min, 2);
+                segment.append(digits, 2);
+                break;
+            case 's':
+                Writedigits(digits, now.tm_sec, 2);
+                segment.append(digits, 2);
+                break;
+            case 'l':
+                // microseconds go between the segments
+                this->segments.push_back("");
+                break;
+            default :
+                segment += this->literals[i];
+                break;
+        }
+    }
+    this->second = second;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Timeformat::Append(uint64_t timestamp, string & out){
+    char digits[6];
+    time_t second = timestamp / 1000000;
+    if(second != this->second)
+        this->Render(second);
+    out += this->segments.front();
+    for(size_t i = 1; i < this->segments.size(); i++){
+        Writedigits(digits, timestamp % 1000000, 6);
+        out.append(digits, 6);
+        out += this->segments[i];
+    }
+}
+//--------------------------------------------------------------------------
+string QuickLogger::impl::Timeformat::Format(uint64_t timestamp){
+    string out;
+    this->Append(timestamp, out);
+    return out;
+}
+//--------------------------------------------------------------------------
+/**
+ * Runs in separate thread. Rolls over the file when the deadline set by 
+ * rolloverperiod is reached. Deadline is an absolute wall clock time, so 
+ * the wait follows changes of the clock, and Halt interrupts it right away.
+ * Size based rollover is done by the flush thread, this thread opens the
+ * next file ahead of time and closes the previous one.
+ */
+void QuickLogger::impl::Autorollover(){
+    this->Startrollover();
+    while(!this->thread_stop){
+        {
+            std::unique_lock<std::mutex> lock(_m_rollover);
+            this->rolloverwakeup.wait_until(lock, this->rolloverdeadline, 
+                                            [this]{
+                return this->rolloverwork || this->thread_stop;
+            });
+        }
+        if(this->thread_stop)
+            break;
+        this->Rolloverstep();
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Startrollover(){
+    this->rolloverrule = this->Parserolloverperiod();
+    this->rolloverdeadline = 
+        this->Calculaterollovertime(this->rolloverrule, system_clock::now());
+    this->nextfilename = this->path + "/.QL_" + this->name + "_" + 
+                         this->stringify(getpid()) + "_" + 
+                         this->stringify(this->id) + ".next";
+    this->Preparenextfile();
+    this->rolloverstarted = true;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Rolloverstep(){
+    {
+        std::lock_guard<std::mutex> lock(_m_rollover);
+        this->rolloverwork = false;
+    }
+    if(system_clock::now() >= this->rolloverdeadline){
+        /* 
+            UNCOMMENT THIS TO ENABLE BUFFER OVERFLOW LOGGING TO THE FILES
+         */
+        // store current buffer overflow counter in the file
+        //this->DirectLog("Buffer overflows for this file: " + 
+        //                 this->stringify(this->bufferoverflowcount.load()));
+        // reset buffer overflows for this file
+        this->bufferoverflowcount.store(0);
+        std::lock_guard<std::mutex> lock(_m_ofstream);
+        steady_clock::time_point start = steady_clock::now();
+        // flush thread could have closed the file for good
+        if(!this->thread_stop){
+            this->Writeout();
+            if(!this->Switchfile()){
+                // nothing to swap with, the file is switched the slow way
+                this->Closefile();
+                this->closingsinks.push_back(std::make_pair(
+                    std::unique_ptr<Sink>(), this->filename));
+                this->filename = this->Uniquefilename();
+                this->Openfile();
+                this->filebytes.store(0);
+                this->rolledfile = true;
+                this->headerbytes = this->output.size();
+            }
+            this->Countrollover(start);
+        }
+        this->rolloverdeadline = 
+            this->Calculaterollovertime(this->rolloverrule, 
+                                        this->rolloverdeadline);
+    }
+    this->Closesinks();
+    this->Preparenextfile();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Preparenextfile(){
+    std::unique_ptr<Sink> next, stale;
+    unsigned long version;
+    {
+        std::lock_guard<std::mutex> lock(_m_ofstream);
+        if(this->nextsink && this->nextsinkversion == this->sinkversion)
+            return;
+        // sink opened before the last Setsink has the old settings
+        stale.swap(this->nextsink);
+        next.reset(this->Newsink());
+        version = this->sinkversion;
+    }
+    if(stale)
+        stale->Close();
+    // could be left over if the process crashed
+    unlink(this->nextfilename.c_str());
+    next->Open(this->nextfilename);
+    std::lock_guard<std::mutex> lock(_m_ofstream);
+    this->nextsink.swap(next);
+    this->nextsinkversion = version;
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Switchfile(){
+    if(!this->nextsink || this->nextsinkversion != this->sinkversion)
+        return false;
+    string filename = this->Uniquefilename();
+    if(!this->nextsink->Rename(filename))
+        return false;
+    this->Writeout();
+    // writes of the drain cycle to the old sink stay counted against the 
+    // count of the new one
+    this->cyclewritecalls = this->nextsink->syscalls.load() - 
+        (this->sink->syscalls.load() - this->cyclewritecalls);
+    this->closingsinks.push_back(std::make_pair(std::move(this->sink), 
+                                                this->filename));
+    this->sink = std::move(this->nextsink);
+    this->filename = filename;
+    this->filebytes.store(0);
+    if(this->format == Format::BINARY)
+        this->Writeheader();
+    this->rolledfile = true;
+    this->headerbytes = this->output.size();
+    this->Requestrollover();
+    return true;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Closesinks(){
+    std::vector<std::pair<std::unique_ptr<Sink>, string>> closing;
+    {
+        std::lock_guard<std::mutex> lock(_m_ofstream);
+        closing.swap(this->closingsinks);
+    }
+    // closing could wait for the writes in flight, the flush thread does not
+    Compression type = (Compression)this->compression.load();
+    for(auto i = closing.begin(); i != closing.end(); i++){
+        // file closed by the slow rollover has no sink left
+        if((*i).first){
+            (*i).first->Close();
+            this->writecalls += (*i).first->syscalls.load();
+        }
+        this->rolledfiles.push_back((*i).second);
+        if(type == Compression::NONE)
+            continue;
+        if(this->engine){
+            // Halt leaves the last files uncompressed, the engine could 
+            // not reach the logger once it is unregistered
+            if(!this->thread_stop)
+                this->engine->Compress(this, (*i).second);
+        }
+        else{
+            std::lock_guard<std::mutex> lock(_m_compress);
+            this->compressqueue.push_back((*i).second);
+            this->compresswakeup.notify_one();
+        }
+    }
+    unsigned int keep = this->maxfiles.load();
+    while(keep > 0 && this->rolledfiles.size() > keep){
+        const string & oldest = this->rolledfiles.front();
+        if(unlink(oldest.c_str()) != 0 && errno != ENOENT)
+            cerr << "Failed to remove file " + oldest + ": " + 
+                    string(strerror(errno)) << endl;
+        // file could be compressed by now, whatever the current setting
+        unlink((oldest + Compressedextension(Compression::GZIP)).c_str());
+        unlink((oldest + Compressedextension(Compression::ZSTD)).c_str());
+        this->rolledfiles.pop_front();
+    }
+}
+//--------------------------------------------------------------------------
+const char * QuickLogger::impl::Compressedextension(Compression type){
+    return (type == Compression::ZSTD) ? ".zst" : ".gz";
+}
+//--------------------------------------------------------------------------
+const char * QuickLogger::impl::Fileextension(Format format){
+    switch(format){
+        case Format::BINARY:
+            return ".log.bin";
+        case Format::JSONL:
+            return ".log.jsonl";
+        default:
+            return ".log.csv";
+    }
+}
+//--------------------------------------------------------------------------
+/**
+ * Runs in separate thread at the lowest CPU and I/O priority, so that the
+ * compression only uses the time the other threads leave.
+ */
+void QuickLogger::impl::Compressfiles(){
+    Idlepriority();
+    std::unique_lock<std::mutex> lock(_m_compress);
+    while(!this->thread_stop){
+        if(this->compressqueue.empty()){
+            this->compresswakeup.wait(lock);
+            continue;
+        }
+        string filename = this->compressqueue.front();
+        this->compressqueue.pop_front();
+        lock.unlock();
+        this->Compressfile(filename, (Compression)this->compression.load());
+        lock.lock();
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Idlepriority(){
+    pid_t thread = syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, thread, 19);
+    // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+    syscall(SYS_ioprio_set, 1, thread, 3 << 13);
+}
+//--------------------------------------------------------------------------
+/**
+ * Compresses the file to a temporary file, renames it to the file name with
+ * the extension of the compression and removes the original. Reading is 
+ * paced to compressionrate.
+ */
+bool QuickLogger::impl::Compressfile(const string & filename, 
+                                     Compression type){
+    std::unique_ptr<Encoder> encoder(Encoder::Create(type));
+    if(!encoder)
+        return false;
+    string target = filename + Compressedextension(type);
+    string partial = target + ".part";
+    int in = open(filename.c_str(), O_RDONLY);
+    if(in < 0){
+        // removed by Setmaxfiles before its turn
+        if(errno != ENOENT)
+            cerr << "Failed to open file " + filename + ": " + 
+                    string(strerror(errno)) << endl;
+        return false;
+    }
+    int out = open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0){
+        cerr << "Failed to open file " + partial + ": " + 
+                string(strerror(errno)) << endl;
+        close(in);
+        return false;
+    }
+    std::unique_ptr<char[]> buffer(new char[256 * 1024]);
+    string compressed;
+    uint64_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = true, last = false;
+    while(ok && !last){
+        ssize_t size = read(in, buffer.get(), 256 * 1024);
+        if(size < 0){
+            if(errno == EINTR)
+                continue;
+            cerr << "Failed to read file " + filename + ": " + 
+                    string(strerror(errno)) << endl;
+            ok = false;
+            break;
+        }
+        last = (size == 0);
+        compressed.clear();
+        ok = encoder->Compress(buffer.get(), size, last, compressed);
+        for(size_t written = 0; ok && written < compressed.size(); ){
+            ssize_t n = write(out, compressed.data() + written, 
+                              compressed.size() - written);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0){
+                cerr << "Failed to write file " + partial + ": " + 
+                        string(strerror(errno)) << endl;
+                ok = false;
+            }
+            else
+                written += n;
+        }
+        // sleeps until the rate is met, shutdown interrupts it
+        bytes += size;
+        uint64_t rate = this->compressionrate.load();
+        if(ok && rate > 0){
+            auto due = start + std::chrono::microseconds(bytes * 1000000 / rate);
+            std::unique_lock<std::mutex> lock(_m_compress);
+            this->compresswakeup.wait_until(lock, due, [this]{
+                return this->thread_stop.load();
+            });
+        }
+        if(this->thread_stop)
+            ok = false;
+    }
+    close(in);
+    if(close(out) != 0)
+        ok = false;
+    if(!ok || rename(partial.c_str(), target.c_str()) != 0){
+        unlink(partial.c_str());
+        return false;
+    }
+    // removed by Setmaxfiles while it was compressed, so is the copy
+    if(unlink(filename.c_str()) != 0)
+        unlink(target.c_str());
+    return true;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Encoder * QuickLogger::impl::Encoder::Create(
+                                                    Compression type){
+#ifdef QL_WITH_ZLIB
+    if(type == Compression::GZIP)
+        return new Gzipencoder();
+#endif
+#ifdef QL_WITH_ZSTD
+    if(type == Compression::ZSTD)
+        return new Zstdencoder();
+#endif
+    // no compression compiled in
+    (void)type;
+    return nullptr;
+}
+#ifdef QL_WITH_ZLIB
+//--------------------------------------------------------------------------
+QuickLogger::impl::Gzipencoder::Gzipencoder(){
+    memset(&this->stream, 0, sizeof(this->stream));
+    // 16 added to the window bits selects the gzip wrapper
+    this->initialized = deflateInit2(&this->stream, Z_DEFAULT_COMPRESSION,
+                                     Z_DEFLATED, 15 + 16, 8, 
+                                     Z_DEFAULT_STRATEGY) == Z_OK;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Gzipencoder::~Gzipencoder(){
+    if(this->initialized)
+        deflateEnd(&this->stream);
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Gzipencoder::Compress(const char * data, size_t size,
+                                              bool last, string & out){
+    if(!this->initialized)
+        return false;
+    char chunk[64 * 1024];
+    this->stream.next_in = (Bytef*)data;
+    this->stream.avail_in = size;
+    int result;
+    do{
+        this->stream.next_out = (Bytef*)chunk;
+        this->stream.avail_out = sizeof(chunk);
+        result = deflate(&this->stream, last ? Z_FINISH : Z_NO_FLUSH);
+        if(result == Z_STREAM_ERROR)
+            return false;
+        out.append(chunk, sizeof(chunk) - this->stream.avail_out);
+    } while(this->stream.avail_out == 0 || (last && result != Z_STREAM_END));
+    return true;
+}
+#endif
+#ifdef QL_WITH_ZSTD
+//--------------------------------------------------------------------------
+QuickLogger::impl::Zstdencoder::Zstdencoder(){
+    this->context = ZSTD_createCCtx();
+    if(this->context != nullptr)
+        ZSTD_CCtx_setParameter(this->context, ZSTD_c_compressionLevel, 3);
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Zstdencoder::~Zstdencoder(){
+    ZSTD_freeCCtx(this->context);
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Zstdencoder::Compress(const char * data, size_t size,
+                                              bool last, string & out){
+    if(this->context == nullptr)
+        return false;
+    char chunk[64 * 1024];
+    ZSTD_inBuffer input = { data, size, 0 };
+    size_t remaining;
+    do{
+        ZSTD_outBuffer output = { chunk, sizeof(chunk), 0 };
+        remaining = ZSTD_compressStream2(this->context, &output, &input,
+                                         last ? ZSTD_e_end : ZSTD_e_continue);
+        if(ZSTD_isError(remaining))
+            return false;
+        out.append(chunk, output.pos);
+    } while(last ? remaining != 0 : input.pos < input.size);
+    return true;
+}
+#endif
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Requestrollover(){
+    {
+        std::lock_guard<std::mutex> lock(_m_rollover);
+        if(this->rolloverwork)
+            return;
+        this->rolloverwork = true;
+        this->rolloverwakeup.notify_one();
+    }
+    if(this->engine)
+        this->engine->Wakerollover();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Halt(){
+    this->thread_stop = true;
+    {
+        std::lock_guard<std::mutex> lock(_m_compress);
+        this->compresswakeup.notify_all();
+    }
+    if(this->engine){
+        // engine is done with the logger, the rest is drained here
+        this->engine->Unregister(this);
+        this->Drain();
+        std::lock_guard<std::mutex> lock(_m_ofstream);
+        this->Closefile();
+    }
+    else{
+        {
+            std::lock_guard<std::mutex> lock(_m_flush);
+            this->wakeup = true;
+            this->flushwakeup.notify_one();
+        }
+        {
+            std::lock_guard<std::mutex> lock(_m_rollover);
+            this->rolloverwakeup.notify_one();
+        }
+        this->flush_thread.join();
+        this->rollover_thread.join();
+    }
+    if(this->compress_thread.joinable())
+        this->compress_thread.join();
+    // no thread works on the logger anymore and the current file is closed
+    this->Closesinks();
+    if(this->rolledfile && this->filebytes.load() <= this->headerbytes)
+        unlink(this->filename.c_str());
+    if(this->nextsink){
+        this->nextsink->Close();
+        this->nextsink.reset();
+        unlink(this->nextfilename.c_str());
+    }
+    // let producer threads release their stages
+    std::lock_guard<std::mutex> lock(_m_stages);
+    for(auto i = this->stages.begin(); i != this->stages.end(); i++)
+        (*i)->closed.store(true, std::memory_order_relaxed);
+}
+//-------------------------------------------------------------------------
+void QuickLogger::impl::Flush(){
+    while(!this->thread_stop){
+        this->Drain();
+        if(this->waitingproducers.load() > 0){
+            std::lock_guard<std::mutex> lock(_m_space);
+            this->spaceready.notify_all();
+        }
+        this->Park();
+    }
+    this->Drain();
+    //this->DirectLog("Buffer overflows for this file: " + 
+    //                         this->stringify(this->bufferoverflowcount.load()));
+    std::lock_guard<std::mutex> lock(_m_ofstream);
+    this->Closefile();
+}
+//--------------------------------------------------------------------------
+/**
+ * Waits for the next drain. Returns right away if the buffers are at the
+ * high-water mark already. Otherwise polls the buffers for spintime, then 
+ * parks: without any timeout while the buffers are empty, and for at most
+ * flushfrequency once there is a message. Parked state is published before
+ * the buffers are checked, thus a message stored after the check always 
+ * finds the thread parked and wakes it.
+ */
+void QuickLogger::impl::Park(){
+    size_t highwatermark = 
+        this->Highwatermark(this->ring.load(std::memory_order_acquire));
+    auto spinend = std::chrono::steady_clock::now() + 
+                   std::chrono::microseconds(this->spintime.load());
+    size_t pending;
+    while((pending = this->Pendingmessages()) == 0 && 
+          std::chrono::steady_clock::now() < spinend && !this->thread_stop)
+        ;
+    if(pending > 0 && this->spintime.load() > 0)
+        return;
+    std::unique_lock<std::mutex> lock(_m_flush);
+    this->flusherstate.store(Parkedidle, std::memory_order_seq_cst);
+    pending = this->Pendingmessages();
+    if(this->waitingproducers.load() > 0){
+        this->flusherstate.store(Running, std::memory_order_relaxed);
+        return;
+    }
+    if(pending == 0){
+        this->flushwakeup.wait(lock, [this]{ 
+            return this->wakeup || this->thread_stop; 
+        });
+        this->wakeup = false;
+    }
+    // first message may wait for the others up to flushfrequency
+    auto deadline = std::chrono::steady_clock::now() + 
+        this->config.load(std::memory_order_acquire)->flushfrequency;
+    this->flusherstate.store(Parked, std::memory_order_seq_cst);
+    if(pending < highwatermark && this->waitingproducers.load() == 0 &&
+       this->Pendingmessages() < highwatermark){
+        this->flushwakeup.wait_until(lock, deadline, [this]{ 
+            return this->wakeup || this->thread_stop; 
+        });
+        this->wakeup = false;
+    }
+    this->flusherstate.store(Running, std::memory_order_relaxed);
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Highwatermark(Ring * buffer){
+    size_t half = std::max(buffer->Limit() / 2, (size_t)1);
+    return std::min(this->highwatermark.load(std::memory_order_relaxed), half);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Wakeflusher(int state){
+    if(!this->flusherstate.compare_exchange_strong(state, Waking))
+        return;
+    if(this->worker != nullptr){
+        this->engine->Wake(this->worker);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_m_flush);
+    this->wakeup = true;
+    this->flushwakeup.notify_one();
+}
+//--------------------------------------------------------------------------
+/**
+ * Engine counterpart of a Flush cycle. The first message is due after 
+ * flushfrequency, same as with Park, unless the buffers reach the 
+ * high-water mark or producers wait for space.
+ */
+steady_clock::time_point QuickLogger::impl::Service(
+                                                steady_clock::time_point now){
+    size_t pending = this->Pendingmessages();
+    if(pending == 0 && this->waitingproducers.load() == 0){
+        this->flushscheduled = false;
+        return steady_clock::time_point::max();
+    }
+    if(!this->flushscheduled){
+        this->flushdue = now + 
+            this->config.load(std::memory_order_acquire)->flushfrequency;
+        this->flushscheduled = true;
+    }
+    if(now < this->flushdue && this->waitingproducers.load() == 0 &&
+       pending < this->Highwatermark(this->ring.load(std::memory_order_acquire)))
+        return this->flushdue;
+    this->Drain();
+    this->flushscheduled = false;
+    if(this->waitingproducers.load() > 0){
+        std::lock_guard<std::mutex> lock(_m_space);
+        this->spaceready.notify_all();
+    }
+    // messages stored meanwhile are scheduled by the next pass
+    return now;
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Parkworker(){
+    this->flusherstate.store(this->flushscheduled ? Parked : Parkedidle, 
+                             std::memory_order_seq_cst);
+    size_t pending = this->Pendingmessages();
+    if(this->waitingproducers.load() > 0)
+        return true;
+    if(!this->flushscheduled)
+        return pending > 0;
+    return pending >= 
+        this->Highwatermark(this->ring.load(std::memory_order_acquire));
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Engine::Engine(unsigned int workers) : 
+        rolloverwakeup(false),
+        compressing(nullptr),
+        stop(false)
+{
+    for(unsigned int i = 0; i < workers; i++){
+        this->workers.emplace_back(new Worker());
+        Worker * worker = this->workers.back().get();
+        worker->thread = std::thread(&Engine::Work, this, worker);
+    }
+    this->rollover_thread = std::thread(&Engine::Rollover, this);
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Engine::~Engine(){
+    this->stop = true;
+    for(auto i = this->workers.begin(); i != this->workers.end(); i++){
+        this->Wake(i->get());
+        (*i)->thread.join();
+    }
+    this->Wakerollover();
+    this->rollover_thread.join();
+    {
+        std::lock_guard<std::mutex> lock(_m_compress);
+        this->compresswakeup.notify_all();
+    }
+    if(this->compress_thread.joinable())
+        this->compress_thread.join();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Engine::Register(impl * logger){
+    Worker * worker = nullptr;
+    size_t load = 0;
+    for(auto i = this->workers.begin(); i != this->workers.end(); i++){
+        std::lock_guard<std::mutex> lock((*i)->_m_loggers);
+        if(worker == nullptr || (*i)->loggers.size() < load){
+            worker = i->get();
+            load = worker->loggers.size();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker->_m_loggers);
+        logger->worker = worker;
+        worker->loggers.push_back(logger);
+    }
+    {
+        std::lock_guard<std::mutex> lock(_m_loggers);
+        this->loggers.push_back(logger);
+    }
+    // rollover thread opens the next file, worker publishes the state
+    this->Wakerollover();
+    this->Wake(worker);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Engine::Unregister(impl * logger){
+    {
+        std::lock_guard<std::mutex> lock(logger->worker->_m_loggers);
+        auto & loggers = logger->worker->loggers;
+        loggers.erase(std::find(loggers.begin(), loggers.end(), logger));
+    }
+    {
+        std::lock_guard<std::mutex> lock(_m_loggers);
+        this->loggers.erase(std::find(this->loggers.begin(), 
+                                      this->loggers.end(), logger));
+    }
+    // files still waiting are left uncompressed, the one being compressed
+    // is stopped by thread_stop of the logger
+    std::unique_lock<std::mutex> lock(_m_compress);
+    this->compressqueue.erase(std::remove_if(compressqueue.begin(), 
+                                             compressqueue.end(),
+        [logger](const std::pair<impl*, string> & file){
+            return file.first == logger;
+        }), this->compressqueue.end());
+    this->compresswakeup.wait(lock, [this, logger]{ 
+        return this->compressing != logger; 
+    });
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Engine::Wake(Worker * worker){
+    std::lock_guard<std::mutex> lock(worker->_m_wakeup);
+    worker->wakeup = true;
+    worker->wakeupcv.notify_one();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Engine::Wakerollover(){
+    std::lock_guard<std::mutex> lock(_m_rollover);
+    this->rolloverwakeup = true;
+    this->rolloverwakeupcv.notify_one();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Engine::Compress(impl * logger, 
+                                         const string & filename){
+    std::lock_guard<std::mutex> lock(_m_compress);
+    this->compressqueue.push_back(std::make_pair(logger, filename));
+    if(!this->compress_thread.joinable())
+        this->compress_thread = std::thread(&Engine::Compressfiles, this);
+    this->compresswakeup.notify_all();
+}
+//--------------------------------------------------------------------------
+/**
+ * Runs in separate thread. Serves its loggers in turns and sleeps until the
+ * earliest of them is due, so the number of wakeups follows the traffic, 
+ * not the number of loggers. Loggers are parked the same way as by Park, 
+ * thus their producers wake the worker with the first message or at the
+ * high-water mark.
+ */
+void QuickLogger::impl::Engine::Work(Worker * worker){
+    std::unique_lock<std::mutex> loggers(worker->_m_loggers);
+    while(!this->stop){
+        steady_clock::time_point due = steady_clock::time_point::max();
+        for(auto i = worker->loggers.begin(); i != worker->loggers.end(); i++)
+            due = std::min(due, (*i)->Service(steady_clock::now()));
+        bool ready = false;
+        for(auto i = worker->loggers.begin(); i != worker->loggers.end(); i++)
+            ready = (*i)->Parkworker() || ready;
+        if(!ready){
+            loggers.unlock();
+            {
+                std::unique_lock<std::mutex> lock(worker->_m_wakeup);
+                auto woken = [this, worker]{ 
+                    return worker->wakeup || this->stop; 
+                };
+                if(due == steady_clock::time_point::max())
+                    worker->wakeupcv.wait(lock, woken);
+                else
+                    worker->wakeupcv.wait_until(lock, due, woken);
+                worker->wakeup = false;
+            }
+            loggers.lock();
+        }
+        for(auto i = worker->loggers.begin(); i != worker->loggers.end(); i++)
+            (*i)->flusherstate.store(Running, std::memory_order_relaxed);
+    }
+}
+//--------------------------------------------------------------------------
+/**
+ * Runs in separate thread. Rolls over the files of all loggers of the 
+ * engine, sleeping until the earliest deadline or a Requestrollover.
+ */
+void QuickLogger::impl::Engine::Rollover(){
+    std::unique_lock<std::mutex> loggers(_m_loggers);
+    while(!this->stop){
+        system_clock::time_point deadline = system_clock::time_point::max();
+        for(auto i = this->loggers.begin(); i != this->loggers.end(); i++){
+            impl * logger = *i;
+            if(!logger->rolloverstarted)
+                logger->Startrollover();
+            else{
+                bool work;
+                {
+                    std::lock_guard<std::mutex> lock(logger->_m_rollover);
+                    work = logger->rolloverwork;
+                }
+                if(work || system_clock::now() >= logger->rolloverdeadline)
+                    logger->Rolloverstep();
+            }
+            deadline = std::min(deadline, logger->rolloverdeadline);
+        }
+        loggers.unlock();
+        {
+            std::unique_lock<std::mutex> lock(_m_rollover);
+            auto woken = [this]{ return this->rolloverwakeup || this->stop; };
+            if(deadline == system_clock::time_point::max())
+                this->rolloverwakeupcv.wait(lock, woken);
+            else
+                this->rolloverwakeupcv.wait_until(lock, deadline, woken);
+            this->rolloverwakeup = false;
+        }
+        loggers.lock();
+    }
+}
+//--------------------------------------------------------------------------
+/**
+ * Runs in separate thread at the lowest CPU and I/O priority, as the 
+ * compress thread of a logger. A single thread serves all the loggers, 
+ * thus their files wait for each other.
+ */
+void QuickLogger::impl::Engine::Compressfiles(){
+    Idlepriority();
+    std::unique_lock<std::mutex> lock(_m_compress);
+    while(!this->stop){
+        if(this->compressqueue.empty()){
+            this->compresswakeup.wait(lock);
+            continue;
+        }
+        std::pair<impl*, string> file = this->compressqueue.front();
+        this->compressqueue.pop_front();
+        this->compressing = file.first;
+        lock.unlock();
+        file.first->Compressfile(file.second, 
+                                 (Compression)file.first->compression.load());
+        lock.lock();
+        this->compressing = nullptr;
+        this->compresswakeup.notify_all();
+    }
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Pendingmessages(){
+    size_t pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(_m_buffer);
+        for(auto i = retiredrings.begin(); i != retiredrings.end(); i++)
+            pending += (*i).ring->Pending();
+    }
+    pending += this->ring.load(std::memory_order_acquire)->Pending();
+    this->Refreshstages();
+    for(auto i = flushstages.begin(); i != flushstages.end(); i++)
+        pending += (*i)->buffer.Pending();
+    return pending;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Refreshstages(){
+    if(this->stagesversion.load() != this->flushstagesversion){
+        std::lock_guard<std::mutex> lock(_m_stages);
+        this->flushstages = this->stages;
+        this->flushstagesversion = this->stagesversion.load();
+    }
+}
+//--------------------------------------------------------------------------
+/**
+ * Drains the ring, the retired rings and the per-thread stages. Messages are
+ * merged by their timestamps, so that the file stays ordered in time even 
+ * though every thread buffers its own messages. Only messages which were 
+ * in the buffers when the cycle started are drained.
+ * There is no buffer to swap with the producers: a message is claimed only
+ * after its producer published it in its slot, and its slot and arena 
+ * record are recycled once they are released, see Next.
+ */
+void QuickLogger::impl::Drain(){
+    std::lock_guard<std::mutex> lock(_m_ofstream);
+    this->Refreshconfig();
+    steady_clock::time_point start = steady_clock::now();
+    long pending = 0, written = 0;
+    Source source;
+    this->sources.clear();
+    this->cyclewritecalls = this->sink->syscalls.load();
+    // rings retired before the epoch are drained for the last time
+    unsigned long epoch = 0;
+    bool reclaim = false;
+    {
+        //retired rings first, they hold the older messages
+        std::lock_guard<std::mutex> lock(_m_buffer);
+        for(auto i = retiredrings.begin(); i != retiredrings.end(); i++){
+            source.buffer = (*i).ring.get();
+            this->sources.push_back(source);
+        }
+        reclaim = !this->retiredrings.empty() && 
+                  this->Advancestoreepoch(epoch);
+    }
+    source.buffer = this->ring.load(std::memory_order_acquire);
+    this->sources.push_back(source);
+    this->Refreshstages();
+    // stages orphaned before the cycle will be empty after it
+    vector<Stage*> orphaned;
+    for(auto i = flushstages.begin(); i != flushstages.end(); i++){
+        if((*i)->orphaned.load(std::memory_order_acquire))
+            orphaned.push_back((*i).get());
+        source.buffer = &(*i)->buffer;
+        this->sources.push_back(source);
+    }
+    for(auto i = sources.begin(); i != sources.end(); i++){
+        (*i).remaining = (*i).buffer->Pending();
+        (*i).batch = (*i).index = 0;
+        pending += (*i).remaining;
+    }
+    // written by the flush thread only
+    if(pending > this->flushstats.queuehighwatermark.load())
+        this->flushstats.queuehighwatermark.store(pending);
+    if(this->sources.size() == 1){
+        // nothing to merge
+        Source & s = this->sources.front();
+        M * m;
+        while((m = this->Next(s)) != nullptr){
+            this->SinkPipe(m);
+            written++;
+        }
+    }
+    else{
+        // k-way merge, sources is turned into the heap of the buffer heads
+        auto later = [](const Source & a, const Source & b){
+            return a.head->timestamp > b.head->timestamp;
+        };
+        auto last = std::remove_if(sources.begin(), sources.end(),
+                                   [this](Source & s){
+            s.head = this->Next(s);
+            return s.head == nullptr;
+        });
+        this->sources.erase(last, this->sources.end());
+        std::make_heap(sources.begin(), sources.end(), later);
+        while(!this->sources.empty()){
+            std::pop_heap(sources.begin(), sources.end(), later);
+            Source & s = this->sources.back();
+            this->SinkPipe(s.head);
+            written++;
+            if((s.head = this->Next(s)) != nullptr)
+                std::push_heap(sources.begin(), sources.end(), later);
+            else
+                this->sources.pop_back();
+        }
+    }
+    unsigned int interval = this->statsreport.load();
+    if(interval > 0 && steady_clock::now() >= this->nextreport){
+        this->Reportstats();
+        this->nextreport = steady_clock::now() + seconds(interval);
+    }
+    if(this->flushconfig->flushonidle && !this->output.empty())
+        this->Writeout();
+    if(this->sink->syscalls.load() != this->cyclewritecalls)
+        this->writecycles++;
+    if(written > 0){
+        this->flushstats.written += written;
+        this->flushstats.draintime[Bucket(steady_clock::now() - start)]++;
+    }
+    if(reclaim){
+        std::lock_guard<std::mutex> lock(_m_buffer);
+        auto last = std::remove_if(retiredrings.begin(), retiredrings.end(),
+                                   [epoch](const Retiredring & r){
+            return r.epoch < epoch && r.ring->Pending() == 0;
+        });
+        this->retiredrings.erase(last, this->retiredrings.end());
+    }
+    if(!orphaned.empty()){
+        std::lock_guard<std::mutex> lock(_m_stages);
+        for(auto i = orphaned.begin(); i != orphaned.end(); i++){
+            if((*i)->buffer.Pending() > 0)
+                continue;
+            auto p = std::find_if(stages.begin(), stages.end(),
+                               [i](const std::shared_ptr<Stage> & s){
+                return s.get() == *i;
+            });
+            if(p != this->stages.end()){
+                this->stages.erase(p);
+                this->stagesversion++;
+            }
+        }
+    }
+}
+//--------------------------------------------------------------------------
+/**
+ * Producers read the epoch, count themselves into its parity and load the
+ * ring, all sequentially consistent. A producer holding a ring retired in
+ * epoch r read an epoch up to r. The epoch passes r + 1 only after the 
+ * producers of parity r are gone, and once it is past r + 1, only after the
+ * ones of parity r + 1 are gone as well, thus the retired ring is out of 
+ * reach when the current epoch is past r and the previous one is empty.
+ */
+bool QuickLogger::impl::Advancestoreepoch(unsigned long & epoch){
+    epoch = this->storeepoch.load();
+    for(unsigned int slot = 0; slot < statslots; slot++)
+        if(this->producerstats[slot].storing[(epoch - 1) & 1].load() != 0)
+            return false;
+    this->storeepoch.store(epoch + 1);
+    return true;
+}
+//--------------------------------------------------------------------------
+template <typename F>
+void QuickLogger::impl::Updateconfig(F update){
+    std::lock_guard<std::mutex> lock(_m_config);
+    const Config * current = this->config.load(std::memory_order_relaxed);
+    std::unique_ptr<Config> next(new Config(*current));
+    update(*next);
+    this->config.store(next.release(), std::memory_order_release);
+    this->retiredconfigs.push_back(std::unique_ptr<const Config>(current));
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Refreshconfig(){
+    std::vector<std::unique_ptr<const Config>> retired;
+    {
+        std::lock_guard<std::mutex> lock(_m_config);
+        retired.swap(this->retiredconfigs);
+    }
+    // snapshots retired before the load are not current, the one taken
+    // here is freed by a later cycle at the earliest
+    this->flushconfig = this->config.load(std::memory_order_acquire);
+    if(this->output.capacity() < this->flushconfig->batchsize)
+        this->output.reserve(this->flushconfig->batchsize);
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::M * QuickLogger::impl::Next(Source & source){
+    if(source.index == source.batch){
+        if(source.batch > 0)
+            source.buffer->Releasebatch();
+        source.index = source.batch = 0;
+        if(source.remaining == 0)
+            return nullptr;
+        source.batch = source.buffer->Claimbatch(std::min(source.remaining,
+                                                          drainbatch));
+        if(source.batch == 0)
+            return nullptr;
+        source.remaining -= source.batch;
+    }
+    // messages handed out before are serialized already
+    else if(source.index % drainrelease == 0)
+        source.buffer->Releaseclaimed(source.index);
+    return source.buffer->Claimed(source.index++);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::SinkPipe(const M * m){
+    if(this->format == Format::BINARY){
+        // field order is stored in the header
+        if(this->flushconfig->fieldsversion != this->headerfieldsversion)
+            this->Writeheader();
+        this->Encodemessage(m);
+    }
+    else if(this->format == Format::JSONL)
+        this->Encodejson(m);
+    else{
+        // go through field order vector and write message to the buffer
+        // in the correct order
+        const std::vector<int> & fieldorder = this->flushconfig->fieldorder;
+        for(auto i = fieldorder.begin(); i != fieldorder.end(); i++){
+            //value should be always found in th map!
+            switch(*i){
+                // time
+                case 0:
+                    this->messageformat.Append(m->timestamp, this->output);
+                    break;
+                // log level
+                case 1:
+                    QuickLoggerCodec::Appendcsv(this->output, 
+                                    m->loglevel.data, m->loglevel.size);
+                    break;
+                // component
+                case 2:
+                    QuickLoggerCodec::Appendcsv(this->output, 
+                                    m->component.data, m->component.size);
+                    break;
+                // message, followed by the fields
+                case 3:{
+                    size_t offset = this->output.size();
+                    if(m->format != nullptr)
+                        QuickLoggerCodec::Formatmessage(m->format, 
+                                    m->arguments.data, 
+                                    m->arguments.size, this->output);
+                    else
+                        this->output.append(m->message.data, m->message.size);
+                    QuickLoggerCodec::Appendfields(m->fields.data, 
+                                    m->fields.size, this->output, false);
+                    QuickLoggerCodec::Quotecsv(this->output, offset);
+                    break;
+                }
+            }
+
+            if(std::next(i) != fieldorder.end()){
+                // configured delimiter could be used
+                this->output += ',';
+            }
+        }
+        this->output += '\n';
+    }
+    if(this->output.size() >= this->flushconfig->batchsize)
+        this->Writeout();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Openfile(){
+    this->sink->Open(this->filename);
+    if(this->format == Format::BINARY)
+        this->Writeheader();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Closefile(){
+    this->Writeout();
+    this->sink->Close();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Writeout(){
+    if(this->output.empty())
+        return;
+    steady_clock::time_point start = steady_clock::now();
+    this->sink->Write(this->output.data(), this->output.size());
+    this->flushstats.iotime += 
+        duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    this->flushstats.iocalls++;
+    this->flushstats.bytes += this->output.size();
+    this->filebytes += this->output.size();
+    this->output.clear();
+    // file is switched between the batches, if the next one is not open 
+    // yet it is retried with the next batch
+    uint64_t limit = this->maxfilesize.load(std::memory_order_relaxed);
+    if(limit > 0 && this->filebytes.load() >= limit){
+        start = steady_clock::now();
+        if(this->Switchfile())
+            this->Countrollover(start);
+        else
+            this->Requestrollover();
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Createsink(){
+    if(this->sink)
+        this->writecalls += this->sink->syscalls.load();
+    this->sink.reset(this->Newsink());
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Sink * QuickLogger::impl::Newsink(){
+    if(this->sinktype == Sinktype::ASYNC)
+        return new Asyncsink(this->directio);
+    else if(this->sinktype == Sinktype::MMAP)
+        return new Mmapsink(this->chunksize);
+    return new Filesink();
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Sink::Rename(const string & filename){
+    if(rename(this->filename.c_str(), filename.c_str()) != 0){
+        cerr << "Failed to rename file " + this->filename + " to " + 
+                filename + ": " + string(strerror(errno)) << endl;
+        return false;
+    }
+    this->filename = filename;
+    return true;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Filesink::Open(const string & filename){
+    this->filename = filename;
+    this->filedescriptor = open(filename.c_str(), 
+                                O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                                0644);
+    if(this->filedescriptor < 0)
+        cerr << "Failed to open file " + 
+                filename + ": " + string(strerror(errno)) << endl;
+}
+//--------------------------------------------------------------------------
+/**
+ * Writes the whole buffer, normally with a single write call. 
+ * Write errors are reported to stderr and the data is dropped.
+ */
+void QuickLogger::impl::Filesink::Write(const char * data, size_t size){
+    while(size > 0 && this->filedescriptor >= 0){
+        ssize_t n = write(this->filedescriptor, data, size);
+        this->syscalls++;
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            cerr << "Failed to write file " + 
+                    this->filename + ": " + string(strerror(errno)) << endl;
+            break;
+        }
+        data += n;
+        size -= n;
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Filesink::Close(){
+    if(this->filedescriptor >= 0)
+        close(this->filedescriptor);
+    this->filedescriptor = -1;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Uring::~Uring(){
+    if(this->ringfd < 0)
+        return;
+    munmap(this->sqes, this->sqessize);
+    if(this->cqring != this->sqring)
+        munmap(this->cqring, this->cqringsize);
+    munmap(this->sqring, this->sqringsize);
+    close(this->ringfd);
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Uring::Setup(unsigned int entries){
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    this->ringfd = syscall(__NR_io_uring_setup, entries, &params);
+    if(this->ringfd < 0)
+        return false;
+    this->sqringsize = params.sq_off.array + 
+                       params.sq_entries * sizeof(unsigned);
+    this->cqringsize = params.cq_off.cqes + 
+                       params.cq_entries * sizeof(io_uring_cqe);
+    // both rings could share the same mapping
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if(single)
+        this->sqringsize = this->cqringsize = 
+                std::max(this->sqringsize, this->cqringsize);
+    this->sqessize = params.sq_entries * sizeof(io_uring_sqe);
+    this->sqring = mmap(NULL, this->sqringsize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, this->ringfd, 
+                        IORING_OFF_SQ_RING);
+    this->cqring = single ? this->sqring : 
+                   mmap(NULL, this->cqringsize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, this->ringfd, 
+                        IORING_OFF_CQ_RING);
+    void * sqes = mmap(NULL, this->sqessize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, this->ringfd, 
+                       IORING_OFF_SQES);
+    if(this->sqring == MAP_FAILED || this->cqring == MAP_FAILED || 
+       sqes == MAP_FAILED){
+        if(sqes != MAP_FAILED)
+            munmap(sqes, this->sqessize);
+        if(this->cqring != MAP_FAILED && this->cqring != this->sqring)
+            munmap(this->cqring, this->cqringsize);
+        if(this->sqring != MAP_FAILED)
+            munmap(this->sqring, this->sqringsize);
+        close(this->ringfd);
+        this->ringfd = -1;
+        return false;
+    }
+    char * sq = (char*)this->sqring;
+    char * cq = (char*)this->cqring;
+    this->sqhead = (unsigned*)(sq + params.sq_off.head);
+    this->sqtail = (unsigned*)(sq + params.sq_off.tail);
+    this->sqmask = (unsigned*)(sq + params.sq_off.ring_mask);
+    this->sqarray = (unsigned*)(sq + params.sq_off.array);
+    this->cqhead = (unsigned*)(cq + params.cq_off.head);
+    this->cqtail = (unsigned*)(cq + params.cq_off.tail);
+    this->cqmask = (unsigned*)(cq + params.cq_off.ring_mask);
+    this->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    this->sqes = (io_uring_sqe*)sqes;
+    return true;
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Uring::Submit(int fd, const iovec * iov, 
+                                      off_t offset, uint64_t tag){
+    unsigned tail = *this->sqtail;
+    unsigned index = tail & *this->sqmask;
+    io_uring_sqe * sqe = &this->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    this->sqarray[index] = index;
+    // kernel reads the entry after it sees the new tail
+    __atomic_store_n(this->sqtail, tail + 1, __ATOMIC_RELEASE);
+    // without SQPOLL the kernel takes entries only in io_uring_enter, called
+    // by this thread only. Published entry has to be taken, or withdrawn 
+    // before the caller reuses the buffer, otherwise a later enter would 
+    // write whatever the buffer holds by then.
+    for(;;){
+        int n = syscall(__NR_io_uring_enter, this->ringfd, 1, 0, 0, NULL, 0);
+        if(__atomic_load_n(this->sqhead, __ATOMIC_ACQUIRE) == tail + 1)
+            return true;
+        if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)){
+            std::this_thread::yield();
+            continue;
+        }
+        int error = errno;
+        __atomic_store_n(this->sqtail, tail, __ATOMIC_RELEASE);
+        errno = error;
+        return false;
+    }
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Uring::Wait(uint64_t & tag, int & result){
+    for(;;){
+        unsigned head = *this->cqhead;
+        if(head != __atomic_load_n(this->cqtail, __ATOMIC_ACQUIRE)){
+            io_uring_cqe * cqe = &this->cqes[head & *this->cqmask];
+            tag = cqe->user_data;
+            result = cqe->res;
+            __atomic_store_n(this->cqhead, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        if(syscall(__NR_io_uring_enter, this->ringfd, 0, 1, 
+                   IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+            return false;
+    }
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Asyncsink::Asyncsink(bool directio) :
+        next(0),
+        filedescriptor(-1),
+        directio(directio),
+        direct(false),
+        offset(0),
+        lasttag(0),
+        workersstop(false)
+{
+    for(int i = 0; i < 2; i++){
+        this->buffers[i].data = nullptr;
+        this->buffers[i].capacity = 0;
+        this->buffers[i].inflight = 0;
+    }
+    this->useuring = this->uring.Setup(4);
+    if(!this->useuring){
+        // one worker per buffer
+        for(int i = 0; i < 2; i++)
+            this->workers.push_back(
+                    std::thread(&QuickLogger::impl::Asyncsink::Worker, this));
+    }
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Asyncsink::~Asyncsink(){
+    this->Close();
+    {
+        std::lock_guard<std::mutex> lock(_m_jobs);
+        this->workersstop = true;
+    }
+    this->jobsqueued.notify_all();
+    for(auto i = workers.begin(); i != workers.end(); i++)
+        (*i).join();
+    for(int i = 0; i < 2; i++)
+        free(this->buffers[i].data);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Asyncsink::Open(const string & filename){
+    this->filename = filename;
+    this->carry.clear();
+    this->direct = false;
+    struct stat st;
+    if(this->directio){
+        this->filedescriptor = open(filename.c_str(), 
+                                O_WRONLY | O_CREAT | O_CLOEXEC | O_DIRECT,
+                                0644);
+        this->direct = this->filedescriptor >= 0;
+    }
+    // file system could refuse O_DIRECT
+    if(!this->direct)
+        this->filedescriptor = open(filename.c_str(), 
+                                    O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(this->filedescriptor < 0 || fstat(this->filedescriptor, &st) != 0){
+        cerr << "Failed to open file " + 
+                filename + ": " + string(strerror(errno)) << endl;
+        if(this->filedescriptor >= 0)
+            close(this->filedescriptor);
+        this->filedescriptor = -1;
+        return;
+    }
+    this->offset = st.st_size;
+    if(this->direct && this->offset % alignment != 0){
+        // partial page of the existing file is rewritten with the new data
+        off_t start = this->offset - this->offset % alignment;
+        this->carry.resize(this->offset - start);
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0 || pread(fd, &this->carry[0], this->carry.size(), start) != 
+                     (ssize_t)this->carry.size()){
+            // not possible to append page by page
+            close(this->filedescriptor);
+            this->filedescriptor = open(filename.c_str(), 
+                                      O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            this->direct = false;
+            this->carry.clear();
+        }
+        else
+            this->offset = start;
+        if(fd >= 0)
+            close(fd);
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Asyncsink::Write(const char * data, size_t size){
+    if(this->filedescriptor < 0)
+        return;
+    Buffer & buffer = this->buffers[this->next];
+    // the buffer was submitted two writes ago
+    this->Wait(buffer);
+    size_t total = this->carry.size() + size;
+    if(buffer.capacity < total){
+        free(buffer.data);
+        buffer.capacity = (total + alignment - 1) / alignment * alignment;
+        if(posix_memalign((void**)&buffer.data, alignment, 
+                          buffer.capacity) != 0){
+            buffer.data = nullptr;
+            buffer.capacity = 0;
+            cerr << "Failed to allocate buffer for file " + 
+                    this->filename << endl;
+            return;
+        }
+    }
+    memcpy(buffer.data, this->carry.data(), this->carry.size());
+    memcpy(buffer.data + this->carry.size(), data, size);
+    size_t length = total;
+    if(this->direct){
+        // O_DIRECT writes whole pages only
+        length = total - total % alignment;
+        this->carry.assign(buffer.data + length, total - length);
+        if(length == 0)
+            return;
+    }
+    buffer.iov.iov_base = buffer.data;
+    buffer.iov.iov_len = length;
+    buffer.offset = this->offset;
+    this->Submit(buffer);
+    this->offset += length;
+    this->next ^= 1;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Asyncsink::Submit(Buffer & buffer){
+    if(this->useuring){
+        buffer.inflight = ++this->lasttag;
+        this->syscalls++;
+        if(!this->uring.Submit(this->filedescriptor, &buffer.iov, 
+                               buffer.offset, buffer.inflight)){
+            buffer.inflight = 0;
+            this->Writesync(buffer.data, buffer.iov.iov_len, buffer.offset);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_m_jobs);
+        buffer.inflight = ++this->lasttag;
+        this->jobs.push_back(&buffer);
+    }
+    this->jobsqueued.notify_one();
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Asyncsink::Wait(Buffer & buffer){
+    // pool workers clear inflight under _m_jobs, it is read only under it
+    if(!this->useuring){
+        std::unique_lock<std::mutex> lock(_m_jobs);
+        this->jobsdone.wait(lock, [&buffer](){ 
+            return buffer.inflight == 0; 
+        });
+        return;
+    }
+    // completions could come in any order
+    while(buffer.inflight != 0){
+        uint64_t tag;
+        int result;
+        this->syscalls++;
+        if(!this->uring.Wait(tag, result)){
+            cerr << "Failed to wait for write of file " + 
+                    this->filename + ": " + string(strerror(errno)) << endl;
+            buffer.inflight = 0;
+            return;
+        }
+        for(int i = 0; i < 2; i++){
+            Buffer & b = this->buffers[i];
+            if(b.inflight != tag)
+                continue;
+            b.inflight = 0;
+            if(result < 0){
+                cerr << "Failed to write file " + this->filename + ": " + 
+                        string(strerror(-result)) << endl;
+            }
+            // short write, rest is written synchronously
+            else if((size_t)result < b.iov.iov_len){
+                this->Writesync(b.data + result, b.iov.iov_len - result,
+                                b.offset + result);
+            }
+        }
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Asyncsink::Writesync(const char * data, size_t size,
+                                             off_t offset){
+    while(size > 0){
+        ssize_t n = pwrite(this->filedescriptor, data, size, offset);
+        this->syscalls++;
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            cerr << "Failed to write file " + 
+                    this->filename + ": " + string(strerror(errno)) << endl;
+            return;
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Asyncsink::Worker(){
+    std::unique_lock<std::mutex> lock(_m_jobs);
+    for(;;){
+        this->jobsqueued.wait(lock, [this](){ 
+            return this->workersstop || !this->jobs.empty(); 
+        });
+        if(this->jobs.empty())
+            return;
+        Buffer * buffer = this->jobs.front();
+        this->jobs.pop_front();
+        lock.unlock();
+        this->Writesync(buffer->data, buffer->iov.iov_len, buffer->offset);
+        lock.lock();
+        buffer->inflight = 0;
+        this->jobsdone.notify_all();
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Asyncsink::Close(){
+    if(this->filedescriptor < 0)
+        return;
+    this->Wait(this->buffers[0]);
+    this->Wait(this->buffers[1]);
+    if(!this->carry.empty()){
+        // last partial page is written padded, then the padding is cut off
+        Buffer & buffer = this->buffers[this->next];
+        if(buffer.capacity < alignment){
+            free(buffer.data);
+            buffer.capacity = alignment;
+            if(posix_memalign((void**)&buffer.data, alignment, alignment) != 0){
+                buffer.data = nullptr;
+                buffer.capacity = 0;
+            }
+        }
+        if(buffer.data != nullptr){
+            memset(buffer.data, 0, alignment);
+            memcpy(buffer.data, this->carry.data(), this->carry.size());
+            this->Writesync(buffer.data, alignment, this->offset);
+            if(ftruncate(this->filedescriptor, 
+                         this->offset + this->carry.size()) != 0)
+                cerr << "Failed to truncate file " + this->filename + ": " +
+                        string(strerror(errno)) << endl;
+        }
+        this->carry.clear();
+    }
+    close(this->filedescriptor);
+    this->filedescriptor = -1;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Mmapsink::Mmapsink(size_t chunksize) :
+        chunksize(chunksize),
+        filedescriptor(-1),
+        length(0),
+        allocated(0),
+        window(nullptr),
+        windowoffset(0),
+        windowlength(0)
+{
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Mmapsink::Open(const string & filename){
+    this->filename = filename;
+    // data is appended after the end of the existing file
+    this->filedescriptor = open(filename.c_str(), 
+                                O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat status;
+    if(this->filedescriptor < 0 || fstat(this->filedescriptor, &status) != 0){
+        cerr << "Failed to open file " + 
+                filename + ": " + string(strerror(errno)) << endl;
+        this->Close();
+        return;
+    }
+    this->length = status.st_size;
+    this->allocated = status.st_size;
+}
+//--------------------------------------------------------------------------
+/**
+ * Copies the data to the mapping, extending the file and moving the window
+ * as needed. Errors are reported to stderr and the data is dropped.
+ */
+void QuickLogger::impl::Mmapsink::Write(const char * data, size_t size){
+    if(this->filedescriptor < 0)
+        return;
+    if(this->length + (off_t)size > this->allocated){
+        // allocate whole chunks, so that writes to the mapping can not fail
+        // with SIGBUS on a full disk
+        off_t chunks = (this->length + size - this->allocated + 
+                        this->chunksize - 1) / this->chunksize;
+        off_t extended = this->allocated + chunks * this->chunksize;
+        int error = posix_fallocate(this->filedescriptor, this->allocated, 
+                                    extended - this->allocated);
+        this->syscalls++;
+        if(error == EOPNOTSUPP || error == EINVAL){
+            // file system without fallocate, the file is extended sparse
+            error = (ftruncate(this->filedescriptor, extended) == 0) ? 
+                    0 : errno;
+            this->syscalls++;
+        }
+        if(error != 0){
+            cerr << "Failed to extend file " + 
+                    this->filename + ": " + string(strerror(error)) << endl;
+            return;
+        }
+        this->allocated = extended;
+    }
+    while(size > 0){
+        off_t end = this->windowoffset + this->windowlength;
+        if(this->window == nullptr || this->length >= end){
+            if(!this->Map(this->length))
+                return;
+            end = this->windowoffset + this->windowlength;
+        }
+        size_t n = std::min(size, (size_t)(end - this->length));
+        memcpy(this->window + (this->length - this->windowoffset), data, n);
+        this->length += n;
+        data += n;
+        size -= n;
+    }
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Mmapsink::Map(off_t offset){
+    this->Unmap();
+    // window starts at the page of the offset and never passes the end of
+    // the allocated file
+    this->windowoffset = offset & ~(off_t)4095;
+    this->windowlength = std::min((off_t)windowsize, 
+                                  this->allocated - this->windowoffset);
+    void * window = mmap(nullptr, this->windowlength, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, this->filedescriptor, this->windowoffset);
+    this->syscalls++;
+    if(window == MAP_FAILED){
+        cerr << "Failed to map file " + 
+                this->filename + ": " + string(strerror(errno)) << endl;
+        this->windowlength = 0;
+        return false;
+    }
+    this->window = (char*)window;
+    return true;
 }
 //--------------------------------------------------------------------------
-void QuickLogger::impl::Log(const string * message, const string * loglevel, const string * component){
-    // map the log level here
-    //lock mutex
-    std::lock_guard<std::mutex> lock(_m_buffer);
-    queue<M> * buff;
-    if(!this->redirectflow.load()){
-        buff = &this->primarybuffer;
-        //cout << "Logging to primary buffer: " << *message << endl;
+void QuickLogger::impl::Mmapsink::Unmap(){
+    if(this->window != nullptr){
+        munmap(this->window, this->windowlength);
+        this->syscalls++;
+    }
+    this->window = nullptr;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Mmapsink::Close(){
+    if(this->filedescriptor < 0)
+        return;
+    this->Unmap();
+    // preallocated space past the data is cut off
+    if(this->allocated > this->length && 
+       ftruncate(this->filedescriptor, this->length) != 0)
+        cerr << "Failed to truncate file " + this->filename + ": " +
+                string(strerror(errno)) << endl;
+    close(this->filedescriptor);
+    this->filedescriptor = -1;
+    this->length = 0;
+    this->allocated = 0;
+}
+//--------------------------------------------------------------------------
+/**
+ * Writes BINARY header followed by the definitions of all ids known so far,
+ * so that each file could be decoded on its own.
+ */
+void QuickLogger::impl::Writeheader(){
+    this->output += QuickLoggerCodec::Header;
+    this->output += "QLB";
+    this->output += QuickLoggerCodec::version;
+    const std::vector<int> & fieldorder = this->flushconfig->fieldorder;
+    QuickLoggerCodec::Putvarint(this->output, fieldorder.size());
+    for(auto i = fieldorder.begin(); i != fieldorder.end(); i++)
+        QuickLoggerCodec::Putvarint(this->output, *i);
+    for(auto i = levelids.begin(); i != levelids.end(); i++){
+        this->output += QuickLoggerCodec::Leveldefinition;
+        QuickLoggerCodec::Putvarint(this->output, (*i).second);
+        QuickLoggerCodec::Putstring(this->output, (*i).first.data(), 
+                                    (*i).first.size());
+    }
+    for(auto i = componentids.begin(); i != componentids.end(); i++){
+        this->output += QuickLoggerCodec::Componentdefinition;
+        QuickLoggerCodec::Putvarint(this->output, (*i).second);
+        QuickLoggerCodec::Putstring(this->output, (*i).first.data(), 
+                                    (*i).first.size());
+    }
+    for(auto i = formatids.begin(); i != formatids.end(); i++){
+        this->output += QuickLoggerCodec::Formatdefinition;
+        QuickLoggerCodec::Putvarint(this->output, (*i).second);
+        QuickLoggerCodec::Putstring(this->output, (*i).first, 
+                                    strlen((*i).first));
+    }
+    // timestamps of the new file are relative to zero
+    this->lasttimestamp = 0;
+    this->headerfieldsversion = this->flushconfig->fieldsversion;
+}
+//--------------------------------------------------------------------------
+template <typename K>
+uint64_t QuickLogger::impl::Intern(std::unordered_map<K, uint64_t> & ids, 
+                                   const K & key,
+                                   QuickLoggerCodec::Record definition,
+                                   const char * value, size_t size){
+    auto p = ids.find(key);
+    if(p != ids.end())
+        return (*p).second;
+    uint64_t id = ids.size();
+    ids.insert(pair<K, uint64_t>(key, id));
+    this->output += definition;
+    QuickLoggerCodec::Putvarint(this->output, id);
+    QuickLoggerCodec::Putstring(this->output, value, size);
+    return id;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Encodemessage(const M * m){
+    uint64_t level, component;
+    // ids are never reassigned, so those of a channel are looked up once
+    const uint64_t unknown = ~(uint64_t)0;
+    if(m->channel != nullptr && m->channel->id < this->channelids.size() &&
+       this->channelids[m->channel->id].first != unknown){
+        level = this->channelids[m->channel->id].first;
+        component = this->channelids[m->channel->id].second;
     }
     else{
-        //cout << "Logging to secondary buffer: " << *message << endl;
-        buff = &this->secondarybuffer;
+        this->internkey.assign(m->loglevel.data, m->loglevel.size);
+        level = this->Intern(this->levelids, this->internkey, 
+                             QuickLoggerCodec::Leveldefinition,
+                             m->loglevel.data, m->loglevel.size);
+        this->internkey.assign(m->component.data, m->component.size);
+        component = this->Intern(this->componentids, this->internkey, 
+                                 QuickLoggerCodec::Componentdefinition,
+                                 m->component.data, m->component.size);
+        if(m->channel != nullptr){
+            if(m->channel->id >= this->channelids.size())
+                this->channelids.resize(m->channel->id + 1, 
+                                        std::make_pair(unknown, unknown));
+            this->channelids[m->channel->id] = std::make_pair(level, 
+                                                              component);
+        }
     }
-    if(buff->size() < this->buffersize){
-        //auto p = this->loglevels.find(*loglevel);
-        buff->push(M(this->GetTime("Y-M-D h:m:s.l"), *loglevel, *component, *message));
+    uint64_t format = 0;
+    if(m->format != nullptr)
+        format = this->Intern(this->formatids, m->format, 
+                              QuickLoggerCodec::Formatdefinition,
+                              m->format, strlen(m->format));
+    this->output += (m->format != nullptr) ? 
+                    QuickLoggerCodec::Formattedmessage : 
+                    (m->fields.size > 0) ? QuickLoggerCodec::Fieldsmessage :
+                    QuickLoggerCodec::Message;
+    QuickLoggerCodec::Putvarint(this->output, QuickLoggerCodec::Zigzag(
+                             (int64_t)(m->timestamp - this->lasttimestamp)));
+    this->lasttimestamp = m->timestamp;
+    QuickLoggerCodec::Putvarint(this->output, level);
+    QuickLoggerCodec::Putvarint(this->output, component);
+    if(m->format != nullptr){
+        QuickLoggerCodec::Putvarint(this->output, format);
+        QuickLoggerCodec::Putstring(this->output, m->arguments.data, 
+                                    m->arguments.size);
     }
     else
-        this->bufferoverflowcount++;
+        QuickLoggerCodec::Putstring(this->output, m->message.data, 
+                                    m->message.size);
+    if(m->format == nullptr && m->fields.size > 0)
+        QuickLoggerCodec::Putstring(this->output, m->fields.data, 
+                                    m->fields.size);
 }
 //--------------------------------------------------------------------------
-/**
- * Generates current human readable timestamp
- * @param format - boolean 
- *        Defines format of the time. 
- *              Y - year 
- *              M - month 
- *              D - day
- *              h - hour
- *              m - minute
- *              s - second
- *              l - microseconds 
- *      Any other character will be outputed as-is.
- * @return string - timestamp
- */
-string QuickLogger::impl::GetTime(std::string format){
-    time_t t;
-    timeval tv;
-    tm * now;
-    gettimeofday(&tv, NULL);
-    t = tv.tv_sec;
-    now = localtime(&t);
-    ostringstream ss;
-    ss << std::setfill('0');
-    for(auto it = format.begin(); it != format.end(); it++){
-        switch(*it){
-            case 'Y':
-                ss << (now->tm_year + 1900);
-                break;
-            case 'M':
-                ss << std::setw(2) << (now->tm_mon + 1);
-                break;
-            case 'D':
-                ss << std::setw(2) << now->tm_mday;
-                break;
-            case 'h':
-                ss << std::setw(2) << now->tm_hour;
-                break;
-            case 'm':
-                ss << std::setw(2) << now->tm_min;
+void QuickLogger::impl::Encodejson(const M * m){
+    // keys follow the field order, there is at least one
+    const std::vector<int> & fieldorder = this->flushconfig->fieldorder;
+    char separator = '{';
+    for(auto i = fieldorder.begin(); i != fieldorder.end(); i++){
+        this->output += separator;
+        separator = ',';
+        switch(*i){
+            // time, its format could have any characters
+            case 0:
+                this->timestamp.clear();
+                this->messageformat.Append(m->timestamp, this->timestamp);
+                this->output += "\"time\":";
+                QuickLoggerCodec::Appendjson(this->output, 
+                                this->timestamp.data(), this->timestamp.size());
                 break;
-            case 's':
-                ss << std::setw(2) << now->tm_sec;
+            case 1:
+                this->output += "\"level\":";
+                QuickLoggerCodec::Appendjson(this->output, 
+                                m->loglevel.data, m->loglevel.size);
                 break;
-            case 'l':
-                ss << std::setw(6) << tv.tv_usec;
+            case 2:
+                this->output += "\"component\":";
+                QuickLoggerCodec::Appendjson(this->output, 
+                                m->component.data, m->component.size);
                 break;
-            default :
-                ss << std::setw(1) <<  *it;
+            // Logf message is formatted aside, then escaped
+            case 3:
+                this->output += "\"message\":";
+                if(m->format != nullptr){
+                    this->formatted.clear();
+                    QuickLoggerCodec::Formatmessage(m->format, 
+                                m->arguments.data, m->arguments.size, 
+                                this->formatted);
+                    QuickLoggerCodec::Appendjson(this->output, 
+                                this->formatted.data(), this->formatted.size());
+                }
+                else
+                    QuickLoggerCodec::Appendjson(this->output, 
+                                m->message.data, m->message.size);
                 break;
         }
     }
-    return ss.str();
+    QuickLoggerCodec::Appendfields(m->fields.data, m->fields.size, 
+                                   this->output, true);
+    this->output += "}\n";
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Ring::Ring(unsigned int size, size_t bytes, 
+                              bool singleproducer) :
+        singleproducer(singleproducer),
+        limit(size),
+        head(0),
+        claimpos(0),
+        released(0),
+        claimed(0),
+        claimedcount(0),
+        claimedreleased(0)
+{
+    // sequences of two laps in the same slot must differ, see Claim
+    uint32_t capacity = 2;
+    while(capacity < size)
+        capacity <<= 1;
+    this->slots = std::vector<Slot>(capacity);
+    this->mask = capacity - 1;
+    // offsets are 32 bit
+    this->arenasize = std::max(std::min(bytes, (size_t)0x7fffffff), (size_t)1);
+    this->arena.reset(new char[this->arenasize]);
+    for(uint32_t i = 0; i < capacity; i++){
+        this->slots[i].sequence.store(0, std::memory_order_relaxed);
+        this->slots[i].end.store(0, std::memory_order_relaxed);
+    }
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Ring::Recordsize(const M & message){
+    size_t size = (message.channel != nullptr) ? message.message.size :
+                  (message.level >= maxlevels ? message.loglevel.size : 0) + 
+                  message.component.size + message.message.size + 
+                  message.arguments.size + message.fields.size;
+    // messages without any text, e.g. Logf without arguments, still take a
+    // byte, otherwise head at the tail of a non-empty arena would not mean
+    // it is full
+    return std::max(size, (size_t)1);
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Ring::Enqueue(const M & message){
+    bool copylevel = message.channel == nullptr && message.level >= maxlevels;
+    size_t bytes = Recordsize(message);
+    if(bytes > this->arenasize)
+        return 0;
+    uint32_t size = bytes, pos, start;
+    size_t pending;
+    uint64_t head = this->head.load(std::memory_order_relaxed);
+    // head is moved with sequential consistency, so that either the flush
+    // thread sees the message before it parks or the producer sees it
+    // parked, see Park
+    for(;;){
+        pos = head >> 32;
+        uint64_t released = this->released.load(std::memory_order_acquire);
+        pending = (uint32_t)(pos - (uint32_t)(released >> 32));
+        // limit set by Setbuffersize could be reached before the arena
+        if(pending >= this->limit.load(std::memory_order_relaxed) ||
+           !this->Fit((uint32_t)head, (uint32_t)released, pending == 0, size,
+                      start))
+            return 0;
+        uint64_t next = ((uint64_t)(uint32_t)(pos + 1) << 32) | (start + size);
+        // nobody else moves head of the single producer ring
+        if(this->singleproducer){
+            this->head.store(next, std::memory_order_seq_cst);
+            break;
+        }
+        if(this->head.compare_exchange_weak(head, next,
+                                            std::memory_order_seq_cst,
+                                            std::memory_order_relaxed))
+            break;
+    }
+    // previous message in the slot is released, since there are less than
+    // limit messages after it
+    Slot & slot = this->slots[pos & this->mask];
+    M & m = slot.message;
+    char * out = this->arena.get() + start;
+    m.timestamp = message.timestamp;
+    m.level = message.level;
+    m.channel = message.channel;
+    m.format = message.format;
+    m.loglevel = copylevel ? Copy(out, message.loglevel) : message.loglevel;
+    m.component = (message.channel == nullptr) ? 
+                  Copy(out, message.component) : message.component;
+    m.message = Copy(out, message.message);
+    m.arguments = Copy(out, message.arguments);
+    m.fields = Copy(out, message.fields);
+    slot.end.store(start + size, std::memory_order_relaxed);
+    slot.sequence.store(pos + 1, std::memory_order_release);
+    return pending + 1;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Text QuickLogger::impl::Ring::Copy(char *& out, 
+                                                      const Text & text){
+    memcpy(out, text.data, text.size);
+    Text copy(out, text.size);
+    out += text.size;
+    return copy;
 }
 //--------------------------------------------------------------------------
 /**
- * Runs in separate thread. All it does is rolls over the file after timeout of
- * value assigned to rolloverperiod occurs.
+ * Records are contiguous. If the record does not fit between the head and
+ * the end of the arena, the rest of the arena is skipped and the record is
+ * placed at the beginning.
  */
-void QuickLogger::impl::Autorollover(){
-    pair<int, map<string, int>::iterator> p = this->Parserolloverperiod();
-    chrono::seconds s = this->Calculaterolloverperiod(p);
-    /* check every 30 ms if the time is right to do a rollover
-     * this is to allow thread to exit gracefully and main thread to be able
-     * to join it */
-    while(!this->thread_stop){
-        std::this_thread::sleep_for(std::chrono::seconds(1));
-        s--;
-        if( s.count() <= 0){
-            /* not locking ofstream mutex here, because DirectLog locks 
-             * it internally
-             */ 
-            /* 
-                UNCOMMENT THIS TO ENABLE BUFFER OVERFLOW LOGGING TO THE FILES
-             */
-            // store current buffer overflow counter in the file
-            //this->DirectLog("Buffer overflows for this file: " + 
-            //                 this->stringify(this->bufferoverflowcount.load()));
-            // reset buffer overflows for this file
-            this->bufferoverflowcount.store(0);
-            // lock ofstream mutex
-            _m_ofstream.lock();
-            // close the current file
-            this->filehandle.close();
-            // generate new filename
-            this->Generatefilename();
-            // open new file
-            try{
-                this->filehandle.open(this->filename.c_str(), ios::app);
-            }
-            catch(std::ofstream::failure e){
-                throw "Failed to open file " + this->filename + ": " + 
-                      string(e.what());
-            }
-            // unlock
-            _m_ofstream.unlock();
-            // calculate next rollover
-            s = this->Calculaterolloverperiod(p);
-        }
+bool QuickLogger::impl::Ring::Fit(uint32_t head, uint32_t tail, bool empty,
+                                  uint32_t size, uint32_t & start){
+    // messages in the arena take [tail, head), or wrap around its end
+    if(empty || head > tail){
+        if(this->arenasize - head >= size)
+            start = head;
+        else if(empty || size <= tail)
+            start = 0;
+        else
+            return false;
     }
+    // head equal to the tail of a non-empty arena means it is full, each
+    // message takes at least a byte
+    else if(tail - head >= size && head != tail)
+        start = head;
+    else
+        return false;
+    return true;
 }
 //--------------------------------------------------------------------------
-void QuickLogger::impl::Halt(){
-    this->thread_stop = true;
-    this->flush_thread.join();
-    this->rollover_thread.join();
+QuickLogger::impl::Ring::Slot * QuickLogger::impl::Ring::Claim(uint32_t & pos){
+    pos = this->claimpos.load(std::memory_order_relaxed);
+    for(;;){
+        Slot * slot = &this->slots[pos & this->mask];
+        uint32_t seq = slot->sequence.load(std::memory_order_acquire);
+        int32_t dif = (int32_t)(seq - (uint32_t)(pos + 1));
+        if(dif == 0){
+            if(this->claimpos.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed))
+                return slot;
+        }
+        // empty, or the producer did not publish the message yet
+        else if(dif < 0)
+            return nullptr;
+        // a producer dropped this message
+        else
+            pos = this->claimpos.load(std::memory_order_relaxed);
+    }
 }
-//-------------------------------------------------------------------------
-void QuickLogger::impl::Flush(){
-    while(!this->thread_stop){
-        this->redirectflow.store(true);
-        //flush primary buffer
-        this->SinkPipe(&primarybuffer);
-        //redirect flow back to the primary buffer
-        this->redirectflow.store(false);
-        this->SinkPipe(&secondarybuffer);
-        std::this_thread::sleep_for(this->flushfrequency);
-    }
-    this->redirectflow.store(true);
-    //flush primary buffer
-    this->SinkPipe(&primarybuffer);
-    //redirect flow back to the primary buffer
-    this->redirectflow.store(false);
-    this->SinkPipe(&secondarybuffer);
-    //this->DirectLog("Buffer overflows for this file: " + 
-    //                         this->stringify(this->bufferoverflowcount.load()));
-    this->filehandle.close();
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Ring::Release(uint32_t pos, uint32_t count){
+    for(uint32_t i = 0; i < count; i++)
+        this->slots[(pos + i) & this->mask].sequence.store(
+                                pos + i + 2, std::memory_order_seq_cst);
+    // whoever releases the oldest message moves released over it and over
+    // the following ones released meanwhile, thus none of them is missed.
+    // Released run is passed with a single exchange.
+    uint64_t released = this->released.load(std::memory_order_seq_cst);
+    for(;;){
+        uint32_t oldest = released >> 32, last = oldest;
+        while(this->slots[last & this->mask].sequence.load(
+                            std::memory_order_seq_cst) == (uint32_t)(last + 2))
+            last++;
+        if(last == oldest)
+            return;
+        uint64_t next = ((uint64_t)last << 32) | 
+            this->slots[(last - 1) & this->mask].end.load(
+                                                std::memory_order_relaxed);
+        if(this->released.compare_exchange_weak(released, next,
+                                                std::memory_order_seq_cst))
+            released = next;
+    }
 }
 //--------------------------------------------------------------------------
-void QuickLogger::impl::SinkPipe(queue<M> * buffer){
-    std::lock_guard<std::mutex> lock(_m_ofstream);
-    auto p = this->loglevels.begin();
-    while(!buffer->empty()){
-        p = this->loglevels.find(buffer->front().loglevel);
-        // flushing only if log level is unknown, or enabled
-        if(p == this->loglevels.end() || (*p).second){
-            // go through field order vector and write message to the stream
-            // in the correct order
-            try{
-                for(auto i = fieldorder.begin(); i != fieldorder.end(); i++){
-                    //value should be always found in th map!
-                    switch(*i){
-                        // time
-                        case 0:
-                            this->filehandle << buffer->front().timestamp;
-                            break;
-                        // log level
-                        case 1:
-                            this->filehandle << buffer->front().loglevel;
-                            break;
-                        // component
-                        case 2:
-                            this->filehandle << buffer->front().component;
-                            break;
-                        // message
-                        case 3:
-                            this->filehandle << buffer->front().message;
-                            break;
-                    }
-
-                    if(std::next(i) != fieldorder.end()){
-                        // configured delimiter could be used
-                        this->filehandle << ",";
-                    }
-                }
-                this->filehandle << endl;
-            }
-            catch(std::ofstream::failure e){
-                cerr << "Failed to open file " + 
-                      this->filename + ": " + string(e.what()) << endl;
-            }
+/**
+ * Takes the run of published messages at claimpos. Only producers dropping
+ * the oldest message race with the consumer here, if one of them moves
+ * claimpos first the run is taken after its message.
+ */
+size_t QuickLogger::impl::Ring::Claimbatch(size_t max){
+    uint32_t pos = this->claimpos.load(std::memory_order_relaxed);
+    for(;;){
+        uint32_t count = 0;
+        while(count < max && 
+              this->slots[(pos + count) & this->mask].sequence.load(
+                std::memory_order_acquire) == (uint32_t)(pos + count + 1))
+            count++;
+        if(count == 0){
+            int32_t dif = (int32_t)(this->slots[pos & this->mask].sequence.load(
+                            std::memory_order_acquire) - (uint32_t)(pos + 1));
+            // empty, or the producer did not publish the message yet
+            if(dif < 0)
+                return 0;
+            // a producer dropped this message
+            pos = this->claimpos.load(std::memory_order_relaxed);
+            continue;
+        }
+        if(this->claimpos.compare_exchange_weak(pos, pos + count,
+                                                std::memory_order_relaxed)){
+            this->claimed = pos;
+            this->claimedcount = count;
+            this->claimedreleased = 0;
+            return count;
         }
-        buffer->pop();
     }
 }
 //--------------------------------------------------------------------------
+QuickLogger::impl::M * QuickLogger::impl::Ring::Claimed(size_t i){
+    return &this->slots[(this->claimed + i) & this->mask].message;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Ring::Releaseclaimed(size_t count){
+    if(count <= this->claimedreleased)
+        return;
+    this->Release(this->claimed + this->claimedreleased, 
+                  count - this->claimedreleased);
+    this->claimedreleased = count;
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Ring::Releasebatch(){
+    this->Releaseclaimed(this->claimedcount);
+    this->claimedcount = 0;
+    this->claimedreleased = 0;
+}
+//--------------------------------------------------------------------------
+/**
+ * Space is released in the order of the slots, thus the oldest unclaimed
+ * message frees its space only if no message before it is still claimed.
+ * Otherwise the drop would cost the message without making any room.
+ */
+bool QuickLogger::impl::Ring::Dropoldest(unsigned int & level){
+    if(this->Claiming())
+        return false;
+    uint32_t pos;
+    Slot * slot = this->Claim(pos);
+    if(slot == nullptr)
+        return false;
+    level = slot->message.level;
+    this->Release(pos);
+    return true;
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Ring::Claiming(){
+    return (uint32_t)(this->released.load(std::memory_order_seq_cst) >> 32) != 
+           this->claimpos.load(std::memory_order_seq_cst);
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Ring::Limit(){
+    return this->limit.load(std::memory_order_relaxed);
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Ring::Bytes(){
+    return this->arenasize;
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Ring::Pending(){
+    return (uint32_t)((uint32_t)(this->head.load(std::memory_order_seq_cst) >> 
+                                 32) - 
+                      this->claimpos.load(std::memory_order_relaxed));
+}
+//--------------------------------------------------------------------------
+bool QuickLogger::impl::Ring::Setlimit(unsigned int size){
+    if(size > this->slots.size())
+        return false;
+    this->limit.store(size, std::memory_order_relaxed);
+    return true;
+}
+//--------------------------------------------------------------------------
 /**
  * Parses rollover period defined by rolloverperiod string.
  * @return std::pair<int, iterator>
@@ -498,82 +3659,80 @@ int QuickLogger::impl::Integerify(string num){
     return x;
 }
 //--------------------------------------------------------------------------
-std::chrono::seconds QuickLogger::impl::Calculaterolloverperiod(
-                                pair<int, map<string, int>::iterator> p){
-    // get current time 
-    std::time_t now = std::time(NULL);
-    // convert to tm structure with local time (server time)
-    std::tm tm = *std::localtime(&now);
-    // this will be returned eventually
-    std::chrono::seconds secs;
-    // set to defaults
-    tm.tm_hour = this->rollovertime.tm_hour;
-    tm.tm_min = this->rollovertime.tm_min;
-    tm.tm_sec = this->rollovertime.tm_sec;
-    // find out which case is it, here we use iterator from timeframes map
+/**
+ * Calculates the wall clock time of the rollover following the previous 
+ * one, or the first one if previous is the start time. Intervals of seconds,
+ * minutes and hours are added to the previous deadline, so that late wakeups
+ * do not accumulate. Other time-frames are calendar dates in local time, 
+ * resolved by mktime with DST determined for the date itself. Deadline which
+ * is already past, e.g. after the clock was set forward, is calculated from
+ * the current time instead.
+ */
+system_clock::time_point QuickLogger::impl::Calculaterollovertime(
+                                pair<int, map<string, int>::iterator> p,
+                                system_clock::time_point previous){
+    system_clock::time_point now = system_clock::now();
+    std::chrono::seconds interval(0);
     switch((*p.second).second){
-        default:
         case 0: // seconds
-            secs = std::chrono::seconds (p.first);
+            interval = std::chrono::seconds(p.first);
             break;
         case 1: // minutes
-            secs = std::chrono::minutes (p.first);
+            interval = std::chrono::minutes(p.first);
             break;
         case 2: // hours
-            secs = std::chrono::hours (p.first);
-            break;
-        case 3: // days
-            //secs = std::chrono::hours (p.first) * 24;
-            tm.tm_mday += p.first;
-            //cout << "secs=" << tm.tm_sec << endl;
-            secs = duration_cast<seconds>
-                                (system_clock::from_time_t(mktime(&tm)) - 
-                                 system_clock::now());
-            break;
-        case 4: // weeks
-            //secs = std::chrono::hours (p.first) * 24 * 7;
-            tm.tm_mday += p.first * 7;
-            secs = duration_cast<seconds>
-                                (system_clock::from_time_t(mktime(&tm)) - 
-                                 system_clock::now());
-            break;
-        case 5: // months
-            tm.tm_mon++;
-            tm.tm_mday = 1;
-            secs = duration_cast<seconds>
-                                (system_clock::from_time_t(mktime(&tm)) - 
-                                 system_clock::now());
-            break;
-        case 6:
+            interval = std::chrono::hours(p.first);
             break;
-        case 7:
-        case 8:
-        case 9:
-        case 10:
-        case 11:
-        case 12:
-        case 13:
-            // since case the switch key holds the value from 7 to 13, 
-            // by subtracting 7, we get offset from the Monday which is useful
-            // if the weekday for this week is passed (runtime case)
-            if(tm.tm_wday >  ((*p.second).second - 7)){
-                tm.tm_mday += (1 + (7 - tm.tm_wday) + ((*p.second).second - 7));
-            }
-            // if the weekday is still in the future (only at startup)
-            else{
-                tm.tm_mday += (1 + ((*p.second).second - 7) - tm.tm_wday);
+    }
+    if(interval.count() > 0){
+        if(previous + interval > now)
+            return previous + interval;
+        // skip the rollovers missed while the clock jumped or the system slept
+        return previous + interval * ((now - previous) / interval + 1);
+    }
+    for(int attempt = 0; ; attempt++){
+        std::time_t base = system_clock::to_time_t(previous);
+        std::tm tm;
+        localtime_r(&base, &tm);
+        tm.tm_hour = this->rollovertime.tm_hour;
+        tm.tm_min = this->rollovertime.tm_min;
+        tm.tm_sec = this->rollovertime.tm_sec;
+        switch((*p.second).second){
+            case 3: // days
+                tm.tm_mday += p.first;
+                break;
+            case 4: // weeks
+                tm.tm_mday += p.first * 7;
+                break;
+            case 5: // months
+                tm.tm_mon += p.first;
+                tm.tm_mday = 1;
+                break;
+            case 6: // years
+                tm.tm_year += p.first;
+                tm.tm_mon = 0;
+                tm.tm_mday = 1;
+                break;
+            default:{
+                // Monday is 7, tm_wday of Monday is 1 and of Sunday is 0
+                int weekday = ((*p.second).second - 6) % 7;
+                tm.tm_mday += (weekday - tm.tm_wday + 7) % 7;
+                // time of the day is passed already. mktime normalizes its
+                // argument, e.g. a time skipped by DST, thus it gets a copy.
+                std::tm candidate = tm;
+                candidate.tm_isdst = -1;
+                if(system_clock::from_time_t(mktime(&candidate)) <= previous)
+                    tm.tm_mday += 7;
+                break;
             }
-            //tm.tm_wday = 0;
-            secs = duration_cast<seconds>
-                                (system_clock::from_time_t(mktime(&tm)) - 
-                                 system_clock::now());
-            break;
+        }
+        // offset of the rollover date, not of the previous one
+        tm.tm_isdst = -1;
+        system_clock::time_point next = system_clock::from_time_t(mktime(&tm));
+        if(next > now || attempt > 0)
+            return next;
+        previous = now;
     }
-    // correction
-    //secs += std::chrono::seconds(1);
-    now = system_clock::to_time_t(system_clock::now() + secs);
-    //printf("Future time will be: %s", ctime(&now));
-    return secs;
 }
 //--------------------------------------------------------------------------
 // Wrapper for impl class setter
@@ -592,15 +3751,19 @@ void QuickLogger::impl::Setfields(string fields){
     // check if there's at least 1 field configured
     if(tokens.size() > 0){
         //this->fields.clear();
-        this->fieldorder.clear();
+        std::vector<int> fieldorder;
         std::map<string, int>::iterator p;
         for(auto i = tokens.begin(); i != tokens.end(); i++){
             p = this->availablefields.find((*i));
             if(p != this->availablefields.end()){
                 //this->fields.insert(pair<int, string>((*p).second,    (*i)));
-                this->fieldorder.push_back((*p).second);
+                fieldorder.push_back((*p).second);
             }
         }
+        this->Updateconfig([&fieldorder](Config & config){
+            config.fieldorder.swap(fieldorder);
+            config.fieldsversion++;
+        });
     }
 }
 //--------------------------------------------------------------------------
@@ -613,12 +3776,61 @@ void QuickLogger::impl::Setloglevels(string levels){
     // explode string by comma
     this->Tokenize(levels, ",", tokens);
     if(tokens.size() > 0){
+        std::lock_guard<std::mutex> lock(_m_levels);
+        const Levels * current = this->levels.load(std::memory_order_relaxed);
+        std::unique_ptr<Levels> next(new Levels(*current));
+        uint64_t added = 0;
         for(auto i = tokens.begin(); i != tokens.end(); i++){
-            this->loglevels.insert(pair<string, int>((*i), true));
+            if(next->ids.find(*i) != next->ids.end())
+                continue;
+            if(next->names.size() == maxlevels){
+                cerr << "Too many log levels, " + (*i) + " is ignored" << endl;
+                continue;
+            }
+            // new levels are enabled
+            added |= 1ull << next->names.size();
+            next->ids.insert(pair<string, unsigned int>((*i), 
+                                                        next->names.size()));
+            next->names.push_back(*i);
         }
+        // tables are kept until the logger is destroyed, thus one is only
+        // published when a level is added
+        if(added == 0)
+            return;
+        this->levels.store(next.release(), std::memory_order_release);
+        this->retiredlevels.push_back(std::unique_ptr<const Levels>(current));
+        this->levelmask.fetch_or(added);
+        this->Updatechannels();
     }
 }
 //--------------------------------------------------------------------------
+unsigned int QuickLogger::impl::Maploglevel(const Text & level){
+    // ids of a table never change, thus the last levels of the thread are
+    // kept with the serial of their table and compared before hashing
+    struct Cachedlevel{
+        Cachedlevel() : serial(0), id(maxlevels) { }
+        unsigned long serial;
+        string key;
+        unsigned int id;
+    };
+    static thread_local Cachedlevel cache[levelcache];
+    static thread_local unsigned int victim = 0;
+    const Levels * levels = this->levels.load(std::memory_order_acquire);
+    for(unsigned int i = 0; i < levelcache; i++)
+        if(cache[i].serial == levels->serial && 
+           cache[i].key.size() == level.size &&
+           memcmp(cache[i].key.data(), level.data, level.size) == 0)
+            return cache[i].id;
+    // the key is reused, so the lookup does not allocate once it has grown
+    // to the longest level name of the thread
+    Cachedlevel & entry = cache[victim++ % levelcache];
+    entry.key.assign(level.data, level.size);
+    auto p = levels->ids.find(entry.key);
+    entry.id = (p != levels->ids.end()) ? (*p).second : maxlevels;
+    entry.serial = levels->serial;
+    return entry.id;
+}
+//--------------------------------------------------------------------------
 /**
  * Tokenizes string by delimiters and stores them in vector
  * @param text - input string
@@ -654,7 +3866,26 @@ long QuickLogger::Getbufferoverflows(){
 //--------------------------------------------------------------------------
 void QuickLogger::impl::Generatefilename(){
     this->filename = this->path + "/QL_" + this->name + "_" + 
-                     this->GetTime(this->time_format) + ".log.csv";
+                     this->filenameformat.Format(GetTime()) + 
+                     Fileextension(this->format);
+}
+//--------------------------------------------------------------------------
+string QuickLogger::impl::Uniquefilename(){
+    string extension = Fileextension(this->format);
+    string base = this->path + "/QL_" + this->name + "_" + 
+                  this->filenameformat.Format(GetTime());
+    string filename = base + extension;
+    // several files could roll over within the precision of the time format,
+    // numbers keep growing, so that names of removed files are not reused
+    unsigned int sequence = (base == this->lastfilebase) ? 
+                            this->lastfilesequence + 1 : 0;
+    if(sequence > 0)
+        filename = base + "_" + this->stringify(sequence) + extension;
+    while(access(filename.c_str(), F_OK) == 0)
+        filename = base + "_" + this->stringify(++sequence) + extension;
+    this->lastfilebase = base;
+    this->lastfilesequence = sequence;
+    return filename;
 }
 //--------------------------------------------------------------------------
 string QuickLogger::Getfilename(){
@@ -662,6 +3893,8 @@ string QuickLogger::Getfilename(){
 }
 //--------------------------------------------------------------------------
 string QuickLogger::impl::Getfilename(){
+    // flush and rollover threads replace it under _m_ofstream
+    std::lock_guard<std::mutex> lock(_m_ofstream);
     return this->filename;
 }
 //--------------------------------------------------------------------------
@@ -671,32 +3904,13 @@ string QuickLogger::impl::Getfilename(){
  */
 void QuickLogger::impl::DirectLog(string message){
     std::lock_guard<std::mutex> lock(_m_ofstream);
-    for(auto i = fieldorder.begin(); i != fieldorder.end(); i++){
-        //value should be always found in th map!
-        switch(*i){
-            // time
-            case 0:
-                this->filehandle << this->GetTime("Y-M-D h:m:s.l");
-                break;
-            // log level
-            case 1:
-                this->filehandle << "INFO";
-                break;
-            // component
-            case 2:
-                this->filehandle << "QuickLogger";
-                break;
-            // message
-            case 3:
-                this->filehandle << message;
-                break;
-        }
-        if(std::next(i) != fieldorder.end()){
-            // configured delimiter could be used
-            this->filehandle << ",";
-        }
-    }
-    this->filehandle << endl;
+    M m;
+    m.timestamp = GetTime();
+    m.loglevel = "INFO";
+    m.component = "QuickLogger";
+    m.message = message;
+    this->SinkPipe(&m);
+    this->Writeout();
 }
 //--------------------------------------------------------------------------
 // Wrapper for impl function with the same name
@@ -706,14 +3920,53 @@ void QuickLogger::Toggleloglevel(string level, bool enabled){
 //--------------------------------------------------------------------------
 void QuickLogger::impl::Toggleloglevel(const string *level, 
                                        const bool *enabled){
-    // Nasty hack, locking _m_ofstream mutex, to blovk the SinkPipe, even
-    // this mutes has nothing to do with the log level toggling.
-    // By doing this, use of additional mutex is not required which saves
-    // CPU time (no need to lock additional mutexes)
-    std::lock_guard<std::mutex> lock(_m_ofstream);
-    auto p = this->loglevels.find(*level);
-    if(p != this->loglevels.end()){
-        (*p).second = *enabled;
+    // producers check the mask before storing the message, thus messages
+    // already in the buffers are written anyway
+    unsigned int id = this->Maploglevel(Text(*level));
+    if(id == maxlevels)
+        return;
+    if(*enabled)
+        this->levelmask.fetch_or(1ull << id);
+    else
+        this->levelmask.fetch_and(~(1ull << id));
+    this->Updatechannels();
+}
+//--------------------------------------------------------------------------
+QuickLogger::Channel QuickLogger::Getchannel(string component, 
+                                             string loglevel){
+    Channelentry * entry = this->PrivateImpl->Getchannel(component, loglevel);
+    return Channel(this, entry, &entry->enabled);
+}
+//--------------------------------------------------------------------------
+QuickLogger::Channelentry * QuickLogger::impl::Getchannel(
+        const string & component, const string & loglevel){
+    std::lock_guard<std::mutex> lock(_m_channels);
+    std::unique_ptr<Channelentry> & entry = 
+        this->channels[std::make_pair(component, loglevel)];
+    if(!entry){
+        entry.reset(new Channelentry(component, loglevel, 
+                                     this->channels.size() - 1));
+        unsigned int level = this->Maploglevel(loglevel);
+        entry->level.store(level);
+        entry->enabled.store(level == maxlevels || 
+                             (this->levelmask.load() & (1ull << level)) != 0);
+    }
+    return entry.get();
+}
+//--------------------------------------------------------------------------
+/**
+ * Whoever changes the mask or the levels calls this afterwards. The flags 
+ * are computed under the lock from the current mask, so the last update 
+ * wins whatever the order of concurrent toggles.
+ */
+void QuickLogger::impl::Updatechannels(){
+    std::lock_guard<std::mutex> lock(_m_channels);
+    uint64_t mask = this->levelmask.load();
+    for(auto i = this->channels.begin(); i != this->channels.end(); i++){
+        Channelentry & entry = *(*i).second;
+        unsigned int level = this->Maploglevel(entry.loglevel);
+        entry.level.store(level);
+        entry.enabled.store(level == maxlevels || (mask & (1ull << level)) != 0);
     }
 }
 //--------------------------------------------------------------------------
@@ -723,7 +3976,21 @@ void QuickLogger::Setflushfrequency(unsigned int flushfreq){
 }
 //--------------------------------------------------------------------------
 void QuickLogger::impl::Setflushfrequency(unsigned int freq){
-    this->flushfrequency = std::chrono::milliseconds(freq);
+    this->Updateconfig([freq](Config & config){
+        config.flushfrequency = std::chrono::milliseconds(freq);
+    });
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setflushtrigger(unsigned int highwatermark, 
+                                  unsigned int spintime){
+    this->PrivateImpl->Setflushtrigger(highwatermark, spintime);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setflushtrigger(unsigned int highwatermark, 
+                                        unsigned int spintime){
+    this->highwatermark.store(highwatermark > 0 ? highwatermark : 1);
+    this->spintime.store(spintime);
 }
 //--------------------------------------------------------------------------
 // Wrapper for the function in class impl with the same name
@@ -732,5 +3999,319 @@ void QuickLogger::Setbuffersize(unsigned int buffersize){
 }
 //--------------------------------------------------------------------------
 void QuickLogger::impl::Setbuffersize(unsigned int size){
+    std::lock_guard<std::mutex> lock(_m_buffer);
+    std::lock_guard<std::mutex> stageslock(_m_stages);
     this->buffersize = size;
+    Ring * current = this->ring.load(std::memory_order_acquire);
+    // ring is reallocated only if it has to grow
+    if(current->Bytes() < this->Arenasize(size) || !current->Setlimit(size)){
+        this->ring.store(new Ring(size, this->Arenasize(size)));
+        this->Retirering(current);
+    }
+    // stages are replaced by their owner threads
+    for(auto i = this->stages.begin(); i != this->stages.end(); i++){
+        if((*i)->buffer.Bytes() < this->Arenasize(size) || 
+           !(*i)->buffer.Setlimit(size))
+            (*i)->resized.store(true, std::memory_order_relaxed);
+    }
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Retirering(Ring * buffer){
+    // epoch read after the new ring is stored, producers which loaded the
+    // old one read the same one or an older one
+    Retiredring retired;
+    retired.ring.reset(buffer);
+    retired.epoch = this->storeepoch.load();
+    this->retiredrings.push_back(std::move(retired));
+}
+//--------------------------------------------------------------------------
+size_t QuickLogger::impl::Arenasize(unsigned int size){
+    return (this->bufferbytes > 0) ? this->bufferbytes : (size_t)size * 256;
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setbufferbytes(size_t bytes){
+    this->PrivateImpl->Setbufferbytes(bytes);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setbufferbytes(size_t bytes){
+    std::lock_guard<std::mutex> lock(_m_buffer);
+    std::lock_guard<std::mutex> stageslock(_m_stages);
+    this->bufferbytes = bytes;
+    // arena is never resized, buffers are replaced
+    Ring * current = this->ring.load(std::memory_order_acquire);
+    this->ring.store(new Ring(this->buffersize, 
+                              this->Arenasize(this->buffersize)));
+    this->Retirering(current);
+    for(auto i = this->stages.begin(); i != this->stages.end(); i++)
+        (*i)->resized.store(true, std::memory_order_relaxed);
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setthreadbuffers(bool enabled){
+    this->PrivateImpl->Setthreadbuffers(enabled);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setthreadbuffers(bool enabled){
+    this->threadbuffers.store(enabled, std::memory_order_relaxed);
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setbatching(unsigned int batchsize, bool flushonidle){
+    this->PrivateImpl->Setbatching(batchsize, flushonidle);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setbatching(unsigned int batchsize, bool flushonidle){
+    // staging buffer grows with the next drain
+    this->Updateconfig([batchsize, flushonidle](Config & config){
+        config.batchsize = batchsize;
+        config.flushonidle = flushonidle;
+    });
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setoverflowpolicy(Overflow policy, unsigned int parameter,
+                                    string level){
+    this->PrivateImpl->Setoverflowpolicy(policy, parameter, level);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setoverflowpolicy(Overflow policy, 
+                                          unsigned int parameter,
+                                          const string & level){
+    unsigned int first = 0, last = maxlevels;
+    if(!level.empty()){
+        first = last = this->Maploglevel(level);
+        if(first == maxlevels){
+            cerr << "Unknown log level " + level << endl;
+            return;
+        }
+    }
+    for(unsigned int i = first; i <= last; i++){
+        this->levelpolicies[i].parameter.store(parameter);
+        this->levelpolicies[i].policy.store((int)policy);
+    }
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+QuickLogger::Overflowcounters QuickLogger::Getoverflowcounters(string level){
+    return this->PrivateImpl->Getoverflowcounters(level);
+}
+//--------------------------------------------------------------------------
+QuickLogger::Overflowcounters 
+QuickLogger::impl::Getoverflowcounters(const string & level){
+    Levelpolicy & policy = this->levelpolicies[this->Maploglevel(level)];
+    Overflowcounters counters;
+    counters.overflows = policy.overflows.load();
+    counters.sampled = policy.sampled.load();
+    counters.blockedtime = policy.blockedtime.load();
+    return counters;
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+double QuickLogger::Getwritesperdrain(){
+    return this->PrivateImpl->Getwritesperdrain();
+}
+//--------------------------------------------------------------------------
+double QuickLogger::impl::Getwritesperdrain(){
+    long cycles = this->writecycles.load();
+    std::lock_guard<std::mutex> lock(_m_ofstream);
+    long calls = this->writecalls.load() + this->sink->syscalls.load();
+    return (cycles > 0) ? (double)calls / cycles : 0;
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Producerstats::Producerstats() : enqueued(0){
+    for(int i = 0; i < Stats::buckets; i++)
+        this->enqueuelatency[i].store(0);
+    this->storing[0].store(0);
+    this->storing[1].store(0);
+}
+//--------------------------------------------------------------------------
+QuickLogger::impl::Flushstats::Flushstats() : 
+        written(0),
+        bytes(0),
+        queuehighwatermark(0),
+        rollovers(0),
+        rollovertime(0),
+        iocalls(0),
+        iotime(0)
+{
+    for(int i = 0; i < Stats::buckets; i++)
+        this->draintime[i].store(0);
+}
+//--------------------------------------------------------------------------
+int QuickLogger::impl::Bucket(steady_clock::duration duration){
+    unsigned long long nanoseconds = 
+        std::max((long long)duration_cast<std::chrono::nanoseconds>(
+                                        duration).count(), 1ll);
+    int bucket = 63 - __builtin_clzll(nanoseconds);
+    return std::min(bucket, Stats::buckets - 1);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Countrollover(steady_clock::time_point start){
+    this->flushstats.rollovers++;
+    this->flushstats.rollovertime += 
+        duration_cast<nanoseconds>(steady_clock::now() - start).count();
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+QuickLogger::Stats QuickLogger::Getstats(){
+    return this->PrivateImpl->Getstats();
+}
+//--------------------------------------------------------------------------
+QuickLogger::Stats QuickLogger::impl::Getstats(){
+    Stats stats;
+    stats.enqueued = 0;
+    for(int i = 0; i < Stats::buckets; i++)
+        stats.enqueuelatency[i] = 0;
+    for(unsigned int slot = 0; slot < statslots; slot++){
+        Producerstats & producer = this->producerstats[slot];
+        stats.enqueued += producer.enqueued.load(std::memory_order_relaxed);
+        for(int i = 0; i < Stats::buckets; i++)
+            stats.enqueuelatency[i] += 
+                producer.enqueuelatency[i].load(std::memory_order_relaxed);
+    }
+    stats.written = this->flushstats.written.load();
+    stats.bytes = this->flushstats.bytes.load();
+    stats.queuehighwatermark = this->flushstats.queuehighwatermark.load();
+    for(int i = 0; i < Stats::buckets; i++)
+        stats.draintime[i] = this->flushstats.draintime[i].load();
+    stats.rollovers = this->flushstats.rollovers.load();
+    stats.rollovertime = this->flushstats.rollovertime.load();
+    stats.iocalls = this->flushstats.iocalls.load();
+    stats.iotime = this->flushstats.iotime.load();
+    return stats;
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setstatsreport(unsigned int interval){
+    this->PrivateImpl->Setstatsreport(interval);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setstatsreport(unsigned int interval){
+    std::lock_guard<std::mutex> lock(_m_ofstream);
+    this->statsreport.store(interval);
+    this->nextreport = steady_clock::now() + seconds(interval);
+}
+//--------------------------------------------------------------------------
+/**
+ * Histograms are reported by their median and 99th percentile, as the upper
+ * bound of the bucket the percentile falls into.
+ */
+void QuickLogger::impl::Reportstats(){
+    Stats stats = this->Getstats();
+    auto percentile = [](const long * histogram, double fraction){
+        long total = 0, count = 0;
+        for(int i = 0; i < Stats::buckets; i++)
+            total += histogram[i];
+        for(int i = 0; i < Stats::buckets; i++){
+            count += histogram[i];
+            if(count > 0 && count >= total * fraction)
+                return 1ll << (i + 1);
+        }
+        return 0ll;
+    };
+    long overflows = 0;
+    for(unsigned int i = 0; i <= maxlevels; i++)
+        overflows += this->levelpolicies[i].overflows.load();
+    string message = "Stats enqueued=" + this->stringify(stats.enqueued) + 
+        " written=" + this->stringify(stats.written) + 
+        " bytes=" + this->stringify(stats.bytes) + 
+        " overflows=" + this->stringify(overflows) + 
+        " queuehighwatermark=" + this->stringify(stats.queuehighwatermark) +
+        " enqueuelatency_p50=" + 
+        this->stringify(percentile(stats.enqueuelatency, 0.5)) +
+        " enqueuelatency_p99=" + 
+        this->stringify(percentile(stats.enqueuelatency, 0.99)) +
+        " draintime_p50=" + this->stringify(percentile(stats.draintime, 0.5)) +
+        " draintime_p99=" + this->stringify(percentile(stats.draintime, 0.99)) +
+        " rollovers=" + this->stringify(stats.rollovers) + 
+        " rollovertime=" + this->stringify(stats.rollovertime) + 
+        " iocalls=" + this->stringify(stats.iocalls) + 
+        " iotime=" + this->stringify(stats.iotime);
+    M m;
+    m.timestamp = GetTime();
+    m.loglevel = "INFO";
+    m.component = "QuickLogger";
+    m.message = message;
+    this->SinkPipe(&m);
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setsink(Sinktype type, bool directio, size_t chunksize){
+    this->PrivateImpl->Setsink(type, directio, chunksize);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setsink(Sinktype type, bool directio, 
+                                size_t chunksize){
+    std::lock_guard<std::mutex> lock(_m_ofstream);
+    // current file is reopened with the new sink
+    this->Closefile();
+    this->sinktype = type;
+    this->directio = directio;
+    // whole pages are mapped
+    this->chunksize = (chunksize + 4095) & ~(size_t)4095;
+    this->Createsink();
+    this->Openfile();
+    // next file is reopened with the new sink
+    this->sinkversion++;
+    this->Requestrollover();
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setmaxfilesize(uint64_t bytes){
+    this->PrivateImpl->Setmaxfilesize(bytes);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setmaxfilesize(uint64_t bytes){
+    this->maxfilesize.store(bytes);
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setmaxfiles(unsigned int files){
+    this->PrivateImpl->Setmaxfiles(files);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setmaxfiles(unsigned int files){
+    this->maxfiles.store(files);
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setbackend(unsigned int workers){
+    impl::Setbackend(workers);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setbackend(unsigned int workers){
+    std::shared_ptr<Engine> engine;
+    if(workers > 0)
+        engine = std::make_shared<Engine>(workers);
+    std::lock_guard<std::mutex> lock(_m_engine);
+    // loggers registered with the previous engine keep it alive
+    sharedengine.swap(engine);
+}
+//--------------------------------------------------------------------------
+// Wrapper for the function in class impl with the same name
+void QuickLogger::Setcompression(Compression type, unsigned int ratelimit){
+    this->PrivateImpl->Setcompression(type, ratelimit);
+}
+//--------------------------------------------------------------------------
+void QuickLogger::impl::Setcompression(Compression type, 
+                                       unsigned int ratelimit){
+    if(type != Compression::NONE){
+        std::unique_ptr<Encoder> encoder(Encoder::Create(type));
+        if(!encoder){
+            cerr << string("Compression ") + 
+                    ((type == Compression::GZIP) ? "GZIP" : "ZSTD") + 
+                    " is not compiled in, files are not compressed" << endl;
+            return;
+        }
+    }
+    this->compressionrate.store((uint64_t)ratelimit << 20);
+    this->compression.store((int)type);
+    std::lock_guard<std::mutex> lock(_m_compress);
+    // loggers of the shared backend use the compress thread of the engine
+    if(type != Compression::NONE && !this->engine && 
+       !this->compress_thread.joinable())
+        this->compress_thread = std::thread(&QuickLogger::impl::Compressfiles,
+                                            this);
+    this->compresswakeup.notify_one();
 }
@@ -9,19 +9,177 @@
 #define	QUICKLOGGER_H
 #include <string>
 #include <memory>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <initializer_list>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 using namespace std;
-/*
- To Do:
- implement log levels
- * 
- */
 class QuickLogger {
 public:
+    /**
+     * Default log levels, used by the typed logging API.
+     */
+    enum class Level { FATAL, ERROR, WARNING, INFO, DEBUG };
+    /**
+     * Output file formats.
+     *  CSV - text lines, fields separated by comma. File name extension is
+     *        .log.csv
+     *  BINARY - compact records with interned levels, components and Logf
+     *        formats. File name extension is .log.bin, use ql-decode tool to
+     *        convert it to CSV or JSON Lines.
+     *  JSONL - JSON Lines, an object per line with the keys time, level,
+     *        component and message in the order set by Setfields, followed
+     *        by the key-value fields of the message. File name extension is
+     *        .log.jsonl
+     */
+    enum class Format { CSV, BINARY, JSONL };
+    /**
+     * The ways messages are written to the file.
+     *  WRITE - write(2) on the flush thread
+     *  ASYNC - io_uring, or a pool of pwrite threads where io_uring is not 
+     *        available. Flush thread does not wait for the disk.
+     *  MMAP - copied to a shared memory mapping of the file, preallocated in
+     *        chunks. Messages written survive a crash of the process, but
+     *        the file is left with zero padding up to the end of the chunk.
+     */
+    enum class Sinktype { WRITE, ASYNC, MMAP };
+    /**
+     * Compression of the rolled over files, see Setcompression.
+     *  NONE - files are left as they are
+     *  GZIP - .gz, needs the library built with QL_WITH_ZLIB, linked with -lz
+     *  ZSTD - .zst, needs QL_WITH_ZSTD, linked with -lzstd
+     */
+    enum class Compression { NONE, GZIP, ZSTD };
+    /**
+     * What happens to a message which does not fit in the buffer.
+     *  DROPNEWEST - the message is dropped
+     *  DROPOLDEST - the oldest message in the buffer is dropped instead. 
+     *        Messages the flush thread is writing are not dropped, the 
+     *        logging call waits for their space up to a timeout.
+     *  BLOCK - the logging call waits for the flush thread, up to a timeout
+     *  SPIN - the logging call retries, yielding the CPU, up to a time limit
+     *  SAMPLE - once the buffer is filled above a threshold, messages are
+     *        kept with a probability falling as the buffer fills up
+     */
+    enum class Overflow { DROPNEWEST, DROPOLDEST, BLOCK, SPIN, SAMPLE };
+    /**
+     * Counters of a log level, see Getoverflowcounters.
+     *  overflows - messages dropped because the buffer was full
+     *  sampled - messages dropped by the SAMPLE policy
+     *  blockedtime - nanoseconds logging calls waited for the buffer
+     */
+    struct Overflowcounters {
+        long overflows;
+        long sampled;
+        long blockedtime;
+    };
+    /**
+     * Counters of the logger since it was created, see Getstats. Durations
+     * are in nanoseconds. Histograms count the events by the power of two 
+     * of their duration: bucket i holds durations from 2^i up to 2^(i+1) - 1,
+     * the last bucket holds the longer ones as well.
+     *  enqueued - messages stored in the buffers
+     *  written - messages written to the files
+     *  bytes - bytes written to the files
+     *  queuehighwatermark - most messages in the buffers at a drain start
+     *  enqueuelatency - durations of storing a message, including the wait
+     *        of the overflow policy. Every 64th call of a thread is measured.
+     *  draintime - durations of the flush cycles which wrote any message
+     *  rollovers - files switched by the rollover
+     *  rollovertime - time the file was held switching, during which the
+     *        flush thread could not write
+     *  iocalls, iotime - writes handed to the sinks and the time spent in them
+     */
+    struct Stats {
+        static const int buckets = 32;
+        long enqueued;
+        long written;
+        long bytes;
+        long queuehighwatermark;
+        long enqueuelatency[buckets];
+        long draintime[buckets];
+        long rollovers;
+        long rollovertime;
+        long iocalls;
+        long iotime;
+    };
+    // encoding of the Logf arguments: tag byte followed by the value. Also
+    // used by the BINARY format.
+    enum Argtag : char {
+        Argsigned = 'i',    // int64_t
+        Argunsigned = 'u',  // uint64_t
+        Argdouble = 'd',    // double
+        Argbool = 'b',      // 1 byte
+        Argchar = 'c',      // 1 byte
+        Argstring = 's'     // uint32_t size followed by the characters
+    };
+    /**
+     * Typed key-value field of a message, see Log. Built from a name and a
+     * value: an integer, floating point number, bool, char, C string or
+     * std::string. Only pointers to the texts are kept, thus fields are 
+     * meant to be temporaries of the logging call, which copies them.
+     * Example: {"order_id", id}
+     */
+    struct Field {
+        Field(const char * name, bool value) : Field(name, Argbool) {
+            this->value.c = value ? 1 : 0;
+        }
+        Field(const char * name, char value) : Field(name, Argchar) {
+            this->value.c = value;
+        }
+        Field(const char * name, const char * value) : 
+                Field(name, Argstring) {
+            this->text = value;
+            this->textsize = strlen(value);
+        }
+        Field(const char * name, const string & value) : 
+                Field(name, Argstring) {
+            this->text = value.data();
+            this->textsize = value.size();
+        }
+        template <typename T, typename enable_if<
+                  is_floating_point<T>::value, int>::type = 0>
+        Field(const char * name, T value) : Field(name, Argdouble) {
+            this->value.d = value;
+        }
+        template <typename T, typename enable_if<
+                  is_integral<T>::value && is_signed<T>::value, int>::type = 0>
+        Field(const char * name, T value) : Field(name, Argsigned) {
+            this->value.i = value;
+        }
+        template <typename T, typename enable_if<
+                  is_integral<T>::value && is_unsigned<T>::value, 
+                  int>::type = 0>
+        Field(const char * name, T value) : Field(name, Argunsigned) {
+            this->value.u = value;
+        }
+        const char * name;
+        size_t namesize;
+        Argtag tag;
+        // value of the numbers, bool and char
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            char c;
+        } value;
+        // characters of the strings
+        const char * text;
+        size_t textsize;
+    private:
+        Field(const char * name, Argtag tag) : name(name), 
+              namesize(strlen(name)), tag(tag), text(nullptr), textsize(0) { }
+    };
     /**
      * Constructor. Any ofstream exceptions are written to stderr.
      * @param path - Required, path to the file. Could be absolute or relative.
      * @param name - File name. Note that the complete file name will be in
-     *   format QL_<name>_<time_format>.log.csv
+     *   format QL_<name>_<time_format>.log.csv (.log.bin for BINARY,
+     *   .log.jsonl for JSONL format)
      * @param time_format - Time format. Default is YMDHm. Accepted placeholders are:
      *   <Y> - 4 digit year
      *   <M> - 2 digit month
@@ -54,11 +212,23 @@ public:
      *     
      *  If nothing is supplied or argument could not be parsed, rollover will
      *  occur every 86400 seconds, from the start of the application.                          
+     *  Rollover times are absolute: days, weeks, months, years and week days
+     *  follow the local time, including DST changes, and intervals do not 
+     *  drift with the time spent rolling over.
      */
     QuickLogger(string path, 
                 string name,
                 string time_format,
                 string rolloverperiod = "");
+    /**
+     * Same as above, writing the given output file format instead of CSV.
+     * @param format - Output file format
+     */
+    QuickLogger(string path, 
+                string name,
+                string time_format,
+                string rolloverperiod,
+                Format format);
     /** 
      * QuickLogger object is not copyable, thus copy constructor is disabled. 
      */
@@ -69,17 +239,79 @@ public:
     ~QuickLogger();
     /**
      * Write message to the log file. Any exceptions are written to stderr.
-     * Average latency of this call is around 10 microseconds on an average
-     * end-user PC or laptop.
+     * Median latency of this call measured by ql_bench (scripts/bench.sh) 
+     * on a single core Xeon VM is about 170 ns in bursts and 400 ns at 
+     * 35 000 messages per second, 99th percentile 1 to 2.5 us for 1 to 64 
+     * threads. Run ql_bench for the figures of the target machine.
+     * Arguments are only read, texts are copied once into the preallocated
+     * buffer and no memory is allocated. Temporary strings bind to these
+     * references without a copy, there is nothing to gain by moving them.
      * @param message
      * @param loglevel - a custom or standard level(if custom is not defined).
      *  Default log levels are: FATAL,ERROR,WARNING,INFO,DEBUG. Log levels are
-     *  case sensitive.
+     *  case sensitive. The last few levels of each thread are mapped to 
+     *  their ids by a string compare, others by a hash lookup. Logf and
+     *  channels skip the mapping.
      * @param component - Component name, could be omitted.
      */
-    void Log(string message, string loglevel, string component = "");
+    void Log(const string & message, const string & loglevel, 
+             const string & component = "");
+    /**
+     * Same as above for null terminated strings, e.g. literals.
+     */
+    void Log(const char * message, const char * loglevel, 
+             const char * component = "");
+    /**
+     * Same as above with key-value fields, written after the message: as
+     * members of the JSONL object, " name=value" pairs appended to the 
+     * message by CSV. Fields are encoded into the buffer as the arguments of
+     * Logf and rendered by the flush thread. Names are not checked, those 
+     * repeating the keys of the JSONL object give duplicate keys.
+     * Example: logger.Log("order filled", "INFO", "Risk", 
+     *                     {{"order_id", id}, {"latency_us", us}});
+     */
+    void Log(const string & message, const string & loglevel, 
+             const string & component, std::initializer_list<Field> fields);
+    void Log(const char * message, const char * loglevel, 
+             const char * component, std::initializer_list<Field> fields);
+#if __cplusplus >= 201703L
+    /**
+     * Same as above for string views, C++17 only. Views do not need to be
+     * null terminated.
+     */
+    void Log(std::string_view message, std::string_view loglevel, 
+             std::string_view component = {}){
+        this->Logtext(message.data(), message.size(), 
+                      loglevel.data(), loglevel.size(),
+                      component.data(), component.size());
+    }
+    void Log(std::string_view message, std::string_view loglevel, 
+             std::string_view component, std::initializer_list<Field> fields){
+        this->Logtext(message.data(), message.size(), 
+                      loglevel.data(), loglevel.size(),
+                      component.data(), component.size(), fields);
+    }
+#endif
     /**
-     * Use this function to set the desirable order of fields-per-line.
+     * Write message with deferred formatting. Only the format pointer and
+     * the raw bytes of the arguments are stored in the buffer, the message
+     * itself is formatted by the flush thread. Each {} in the format is 
+     * replaced with the next argument.
+     * Example: logger.Logf<QuickLogger::Level::INFO>("order {} filled at {}",
+     *                                                 id, price);
+     * @param level - one of the default log levels
+     * @param format - string literal. Only the pointer is stored, thus it 
+     *  must be valid until the logger is destroyed.
+     * @param args - integers, floating point numbers, bool, char, C strings
+     *  and std::string. Strings are copied.
+     */
+    template <Level level, size_t N, typename... Args>
+    void Logf(const char (&format)[N], const Args &... args);
+    /**
+     * Use this function to set the desirable order of fields-per-line, the
+     * keys of the JSONL objects follow the same order.
+     * Could be changed while logging, the new order is used from the next
+     * flush on. Logging calls are not blocked.
      *  
      * @param fields - a list of fields separated by comma.
      *  Available fields are (case sensitive): TIME,LEVEL,COMPONENT,MESSAGE.
@@ -88,7 +320,9 @@ public:
     void Setfields(string fields);
     /**
      * Set log levels, all string values available. Use the same values when
-     * logging any messages.
+     * logging any messages. Levels are added to the defined ones, enabled,
+     * up to 64 levels in total. Messages of undefined levels are always
+     * written.
      * @param levels - a list of log levels separated by comma.
      *  Default fields are: FATAL,ERROR,WARNING,INFO,DEBUG
      */
@@ -105,29 +339,299 @@ public:
      */
     string Getfilename();
     /**
-     * Toggle log level
+     * Toggle log level. Messages of a disabled level are dropped by the 
+     * logging call itself, those already buffered are still written.
      * @param level - string representation of the log level
      * @param enabled - trivial - true or false 
      */
     void Toggleloglevel(string level, bool enabled);
+    /**
+     * Tells whether messages of the default level are written, a single 
+     * load. Lets call sites skip building the arguments of a disabled level.
+     * @return bool - false if the level is disabled by Toggleloglevel
+     */
+    template <Level level>
+    bool Enabled() const {
+        return (this->levelmask->load(std::memory_order_relaxed) & 
+                (1ull << (int)level)) != 0;
+    }
+    class Channel;
+    /**
+     * Returns the channel of the component and log level, see Channel. The
+     * pair is interned on the first call, later calls return a channel with
+     * the same id.
+     * Example: auto orders = logger.Getchannel("OrderBook", "INFO");
+     *          orders.Log("order filled");
+     * @param component - Component name
+     * @param loglevel - a custom or standard level, channel of a level which
+     *  is not defined yet picks it up when Setloglevels defines it.
+     * @return Channel - valid until the logger is destroyed
+     */
+    Channel Getchannel(string component, string loglevel);
     /* With the configuration below it's possible to tune the performance of
-     * the QuickLogger. With default configuration QuickLogger is able to handle
-     * 35 000 MPS (messages per second) without buffer overflows on an average
-     * end-user PC or laptop. */
+     * the QuickLogger. With default configuration ql_bench logs 35 000 MPS 
+     * (messages per second) from 1 to 64 threads without buffer overflows on
+     * a single core Xeon VM. Bursts above the flush rate overflow the default
+     * buffer, ql_bench reports the overflow rate for a given Setbuffersize 
+     * and Setflushfrequency. */
     /**
-     * Sets the flush frequency at which buffer is flushed to disk.
+     * Sets the maximum time a message waits in the buffer before it is 
+     * flushed to disk. Flush thread sleeps while the buffers are empty and
+     * is woken by the first message.
      * Default is 10 milliseconds
      * @param flushfreq - time, in milliseconds
      */
     void Setflushfrequency(unsigned int flushfreq);
+    /**
+     * Configures when the flush thread is woken before the flush frequency
+     * elapses.
+     * @param highwatermark - number of messages in a buffer which wakes the
+     *  flush thread right away, capped at the half of the buffer size. Full
+     *  buffer always wakes it. Default is 500, half of the default buffer.
+     * @param spintime - time, in microseconds, the flush thread keeps 
+     *  polling the buffers after a flush before it sleeps. Messages arriving
+     *  meanwhile are flushed without waiting, at the cost of a busy CPU.
+     *  Default is 0, no polling.
+     */
+    void Setflushtrigger(unsigned int highwatermark, unsigned int spintime = 0);
+    /**
+     * Makes the loggers constructed afterwards share a process-wide backend
+     * instead of starting a flush and a rollover thread each. Its worker 
+     * threads drain the buffers of all the loggers, each logger is assigned
+     * to the least loaded worker, and a single thread rolls over their 
+     * files. A single thread compresses the rolled over files of all of 
+     * them, see Setcompression. Thread count stays the same however many
+     * loggers there are. Writes are not batched across loggers, each one
+     * writes its own file, and the destructor of a logger drains its last
+     * messages on the calling thread.
+     * Loggers constructed before keep their threads or backend.
+     * Setflushtrigger spintime is not used by the shared backend.
+     * Example: QuickLogger::Setbackend(2);   // before the loggers are made
+     * @param workers - number of worker threads, 0 returns to the threads
+     *  of each logger. Default is 0.
+     */
+    static void Setbackend(unsigned int workers);
+    /**
+     * Sets what happens to the messages which do not fit in the buffer.
+     * Default is DROPNEWEST for all levels. 
+     * Example: keep errors at the cost of the debug messages
+     *   logger.Setoverflowpolicy(QuickLogger::Overflow::BLOCK, 5000, "ERROR");
+     *   logger.Setoverflowpolicy(QuickLogger::Overflow::SAMPLE, 50, "DEBUG");
+     * @param policy - overflow policy
+     * @param parameter - BLOCK and DROPOLDEST: timeout in microseconds, 
+     *  1000 if 0.
+     *  SPIN: time limit in nanoseconds, 10000 if 0. SAMPLE: percentage of
+     *  the buffer filled before the sampling starts, 50 if 0. Ignored by
+     *  the other policies.
+     * @param level - log level the policy applies to. Empty for all levels,
+     *  including the undefined ones.
+     */
+    void Setoverflowpolicy(Overflow policy, unsigned int parameter = 0,
+                           string level = "");
+    /**
+     * Get the overflow counters of a log level. Unlike Getbufferoverflows,
+     * counters are not reset on rollover. Messages dropped by DROPOLDEST are
+     * counted on their own level.
+     * @param level - log level, counters of all undefined levels are shared
+     * @return Overflowcounters - counters of the level
+     */
+    Overflowcounters Getoverflowcounters(string level);
     /**
      * Sets the buffer size. Small buffer will probably cause more buffer 
      * overflows
-     * Default is 1000 messages.
+     * Default is 1000 messages. Buffer is preallocated, thus growing it
+     * beyond its current capacity allocates a new one.
      * @param buffersize - buffer size in messages
      */
     void Setbuffersize(unsigned int buffersize);
+    /**
+     * Sets the memory available to the texts of the buffered messages: level,
+     * component, message and Logf arguments. The bytes are preallocated and
+     * reused, messages are stored without any heap allocation. A message 
+     * overflows if either the message count or the bytes are exhausted, 
+     * a message bigger than the whole budget is always dropped.
+     * The buffer is replaced by a new one, the memory of the old buffer is 
+     * released by the flush thread once it is drained and no logging call 
+     * uses it anymore. With per-thread buffers each thread gets its own 
+     * budget.
+     * Default is 256 bytes per message of the buffer size, following
+     * Setbuffersize.
+     * @param bytes - size of the buffer in bytes, 0 to restore the default
+     */
+    void Setbufferbytes(size_t bytes);
+    /**
+     * Enables per-thread buffers. Each thread logging to this logger gets
+     * its own buffer of Setbuffersize messages on its first message, so
+     * producers do not contend with each other at all. Buffers are merged in
+     * timestamp order when flushed and released when their threads exit.
+     * Default is disabled, all threads share the same buffer.
+     * @param enabled - true or false
+     */
+    void Setthreadbuffers(bool enabled);
+    /**
+     * Configures batching of the file writes. Messages are serialized into a
+     * staging buffer which is written to the file with a single write call
+     * once it collects batchsize bytes.
+     * Default is 65536 bytes, flushed on idle.
+     * @param batchsize - size of the batch in bytes
+     * @param flushonidle - true: partial batch is written at the end of each
+     *  flush cycle. false: partial batch waits until it is full, the file is
+     *  rolled over or the logger is destroyed.
+     */
+    void Setbatching(unsigned int batchsize, bool flushonidle = true);
+    /**
+     * Average number of write calls per flush cycle, counting only the cycles
+     * which wrote anything. Should stay close to 1 unless the batch size is
+     * small compared to the amount of messages per cycle.
+     * @return double - write calls per flush cycle
+     */
+    double Getwritesperdrain();
+    /**
+     * Snapshot of the counters of the logger. Counters are updated without 
+     * any lock, thus the snapshot may be a few messages off between them.
+     * @return Stats - counters since the logger was created
+     */
+    Stats Getstats();
+    /**
+     * Writes the counters of Getstats into the log every interval, as a 
+     * message of level INFO and component QuickLogger. The report is written
+     * with the first flush after the interval elapses, an idle logger does
+     * not write any.
+     * Default is 0, no report.
+     * @param interval - time between the reports, in seconds. 0 disables it.
+     */
+    void Setstatsreport(unsigned int interval);
+    /**
+     * Selects the way messages are written to the file. The current file is
+     * reopened with the new sink. Default is WRITE.
+     * @param type - sink type
+     * @param directio - ASYNC only. Opens the file with O_DIRECT, keeping log
+     *  data out of the page cache. Whole pages are written only, the last 
+     *  partial page is written when the file is closed. Ignored if the file
+     *  system does not support O_DIRECT.
+     * @param chunksize - MMAP only. File is preallocated by chunks of this
+     *  size, and truncated to the length of the data when closed. Default is
+     *  16 MB.
+     */
+    void Setsink(Sinktype type, bool directio = false, 
+                 size_t chunksize = 16 << 20);
+    /**
+     * Rolls over the file when it reaches the size, in addition to the
+     * rollover period. The file is rolled over once the write crossing the
+     * limit completes, thus it could exceed it by a batch. Next file is 
+     * opened ahead of time in the background, so that rollover does not
+     * hold up the flush thread.
+     * Default is 0, which disables the size limit.
+     * @param bytes - maximum file size in bytes
+     */
+    void Setmaxfilesize(uint64_t bytes);
+    /**
+     * Sets the number of rolled over files kept. Once there are more, the 
+     * oldest one is removed by the rollover thread. Only the files created 
+     * by this logger are counted, the current file is not.
+     * Default is 0, which keeps all files.
+     * @param files - number of files to keep
+     */
+    void Setmaxfiles(unsigned int files);
+    /**
+     * Compresses each file once it is rolled over and removes the original.
+     * Files are compressed one by one by a background thread, the one of 
+     * the shared backend for its loggers, at the lowest CPU and I/O 
+     * priority, reading at most ratelimit MB per second so that it does not
+     * compete with the flush thread. Files still waiting when
+     * the logger is destroyed are left uncompressed. Files removed by 
+     * Setmaxfiles are removed together with their compressed copies.
+     * Default is NONE. If the compression is not compiled in, an error is 
+     * written to stderr and files are left as they are.
+     * @param type - compression of the files
+     * @param ratelimit - MB read per second, 0 for no limit. Default is 32.
+     */
+    void Setcompression(Compression type, unsigned int ratelimit = 32);
 private:
+    // level, component and enabled flag of a channel, owned by the logger
+    struct Channelentry;
+    // stores message of a channel
+    void Logchannel(Channelentry * entry, const char * message, size_t size);
+    // stores message given by pointers and sizes of its texts, the string 
+    // view overload is inline, so the library does not depend on C++17
+    void Logtext(const char * message, size_t messagesize,
+                 const char * loglevel, size_t loglevelsize,
+                 const char * component, size_t componentsize,
+                 std::initializer_list<Field> fields = {});
+    // stores message of Logf with encoded arguments
+    void Logformatted(Level level, const char * format, 
+                      const char * arguments, size_t size);
+    // number of bytes needed to encode the arguments
+    static size_t Argumentsize() { return 0; }
+    template <typename T, typename... Rest>
+    static size_t Argumentsize(const T & value, const Rest &... rest){
+        return Encodedsize(value) + Argumentsize(rest...);
+    }
+    static size_t Encodedsize(bool) { return 2; }
+    static size_t Encodedsize(char) { return 2; }
+    static size_t Encodedsize(const char * value) {
+        return 1 + sizeof(uint32_t) + strlen(value);
+    }
+    static size_t Encodedsize(const string & value) {
+        return 1 + sizeof(uint32_t) + value.size();
+    }
+    template <typename T>
+    static typename enable_if<is_arithmetic<T>::value, size_t>::type
+    Encodedsize(T) { return 1 + 8; }
+    // encodes the arguments to out, advancing it
+    static void Encodearguments(char *&) { }
+    template <typename T, typename... Rest>
+    static void Encodearguments(char *& out, const T & value, 
+                                const Rest &... rest){
+        Encode(out, value);
+        Encodearguments(out, rest...);
+    }
+    static void Encode(char *& out, bool value){
+        *out++ = Argbool;
+        *out++ = value ? 1 : 0;
+    }
+    static void Encode(char *& out, char value){
+        *out++ = Argchar;
+        *out++ = value;
+    }
+    static void Encode(char *& out, const char * value){
+        Encodestring(out, value, strlen(value));
+    }
+    static void Encode(char *& out, const string & value){
+        Encodestring(out, value.data(), value.size());
+    }
+    static void Encodestring(char *& out, const char * value, size_t size){
+        uint32_t s = size;
+        *out++ = Argstring;
+        memcpy(out, &s, sizeof(s));
+        memcpy(out + sizeof(s), value, size);
+        out += sizeof(s) + size;
+    }
+    template <typename T>
+    static typename enable_if<is_floating_point<T>::value>::type
+    Encode(char *& out, T value){
+        double v = value;
+        *out++ = Argdouble;
+        memcpy(out, &v, sizeof(v));
+        out += sizeof(v);
+    }
+    template <typename T>
+    static typename enable_if<is_integral<T>::value && is_signed<T>::value>::type
+    Encode(char *& out, T value){
+        int64_t v = value;
+        *out++ = Argsigned;
+        memcpy(out, &v, sizeof(v));
+        out += sizeof(v);
+    }
+    template <typename T>
+    static typename enable_if<is_integral<T>::value && 
+                              is_unsigned<T>::value>::type
+    Encode(char *& out, T value){
+        uint64_t v = value;
+        *out++ = Argunsigned;
+        memcpy(out, &v, sizeof(v));
+        out += sizeof(v);
+    }
     /**
      * Private implementation of the library. This approach allows updates of
      * the library (if interface does not change) without the recompilation of
@@ -135,7 +639,80 @@ private:
      */
     class impl;
     std::unique_ptr<impl> PrivateImpl;
+    /**
+     * Bit per log level id in impl, set if the level is enabled. Ids of the
+     * default levels are the values of Level, so that Logf of a disabled
+     * level costs a single load. Set by the constructor.
+     */
+    const std::atomic<uint64_t> * levelmask;
+};
+
+/**
+ * Handle of a component and log level pair returned by Getchannel. Messages
+ * of a channel do not carry the level and component strings, they refer to
+ * the channel instead, and the BINARY format looks up their ids once per 
+ * channel. Enabled flag of the channel is updated by Toggleloglevel, thus 
+ * Log of a disabled channel costs a single load.
+ * Channels are copyable and could be used by any thread. Default channel
+ * discards all messages.
+ */
+class QuickLogger::Channel {
+public:
+    Channel() : logger(nullptr), entry(nullptr), enabled(nullptr) { }
+    /**
+     * Write message to the log file, see QuickLogger::Log.
+     */
+    void Log(const string & message){
+        if(this->Enabled())
+            this->logger->Logchannel(this->entry, message.data(), 
+                                     message.size());
+    }
+    void Log(const char * message){
+        if(this->Enabled())
+            this->logger->Logchannel(this->entry, message, strlen(message));
+    }
+#if __cplusplus >= 201703L
+    void Log(std::string_view message){
+        if(this->Enabled())
+            this->logger->Logchannel(this->entry, message.data(), 
+                                     message.size());
+    }
+#endif
+    /**
+     * @return bool - false if the level of the channel is disabled
+     */
+    bool Enabled() const {
+        return this->enabled != nullptr && 
+               this->enabled->load(std::memory_order_relaxed);
+    }
+private:
+    friend class QuickLogger;
+    Channel(QuickLogger * logger, Channelentry * entry,
+            const std::atomic<bool> * enabled) :
+        logger(logger), entry(entry), enabled(enabled) { }
+    QuickLogger * logger;
+    Channelentry * entry;
+    const std::atomic<bool> * enabled;
 };
 
+//--------------------------------------------------------------------------
+template <QuickLogger::Level level, size_t N, typename... Args>
+void QuickLogger::Logf(const char (&format)[N], const Args &... args){
+    if(!this->Enabled<level>())
+        return;
+    // arguments are encoded on the stack unless they are too big
+    char stack[256];
+    size_t size = Argumentsize(args...);
+    std::unique_ptr<char[]> heap;
+    char * arguments = stack;
+    if(size > sizeof(stack)){
+        heap.reset(new char[size]);
+        arguments = heap.get();
+    }
+    char * out = arguments;
+    Encodearguments(out, args...);
+    this->Logformatted(level, format, arguments, size);
+}
+
 #endif	/* QUICKLOGGER_H */
 
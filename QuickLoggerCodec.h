@@ -0,0 +1,477 @@
+/*
+ * File:   QuickLoggerCodec.h
+ * Author: hitman
+ *
+ * Encoding shared by QuickLogger and the ql-decode tool: Logf argument
+ * and key-value field decoding, number formatting, CSV quoting, JSON string
+ * escaping and the binary log file format.
+ *
+ * Binary file is a sequence of records, each starting with the record type
+ * byte. Integers are unsigned LEB128 varints, strings are a varint size
+ * followed by the characters.
+ *   'Q' - header: "QLB", version byte, varint count and field ids (see
+ *         Setfields). Resets ids and the timestamp base, thus it is written
+ *         at the head of each file and each time a file is reopened.
+ *   'L' - log level definition: varint id, string
+ *   'C' - component definition: varint id, string
+ *   'S' - Logf format definition: varint id, string
+ *   'M' - message: zigzag varint of timestamp delta in microseconds from the
+ *         previous record, varint level id, varint component id, string
+ *   'P' - Logf message: timestamp delta, level id, component id, varint
+ *         format id, string of arguments encoded as by QuickLogger::Logf
+ *   'K' - message with key-value fields: as 'M', followed by string of the
+ *         fields, pairs of a name and a value encoded as Logf arguments
+ * Definitions of all known ids follow the header, ids first seen later are
+ * defined right before the record using them.
+ * Zero bytes between records are padding, left by the MMAP sink if the
+ * process crashed before the file was truncated.
+ */
+
+#ifndef QUICKLOGGERCODEC_H
+#define	QUICKLOGGERCODEC_H
+#include "QuickLogger.h"
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+class QuickLoggerCodec {
+public:
+    // record types of the binary file
+    enum Record : char {
+        Padding = 0,
+        Header = 'Q',
+        Leveldefinition = 'L',
+        Componentdefinition = 'C',
+        Formatdefinition = 'S',
+        Message = 'M',
+        Formattedmessage = 'P',
+        Fieldsmessage = 'K'
+    };
+    // binary format version written in the header, 2 added 'K' records.
+    // Files of older versions are read as well.
+    static const char version = 2;
+    //--------------------------------------------------------------------------
+    static void Putvarint(string & out, uint64_t value){
+        char bytes[10];
+        int n = 0;
+        while(value >= 0x80){
+            bytes[n++] = (char)(value | 0x80);
+            value >>= 7;
+        }
+        bytes[n++] = (char)value;
+        out.append(bytes, n);
+    }
+    //--------------------------------------------------------------------------
+    // returns false if the input ends before the varint does
+    static bool Getvarint(const char *& in, const char * end, uint64_t & value){
+        value = 0;
+        for(int shift = 0; in < end && shift < 64; shift += 7){
+            unsigned char byte = *in++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+    //--------------------------------------------------------------------------
+    static void Putstring(string & out, const char * value, size_t size){
+        Putvarint(out, size);
+        out.append(value, size);
+    }
+    //--------------------------------------------------------------------------
+    // returns false if the input ends before the string does
+    static bool Getstring(const char *& in, const char * end,
+                          const char *& value, size_t & size){
+        uint64_t s;
+        if(!Getvarint(in, end, s) || (uint64_t)(end - in) < s)
+            return false;
+        value = in;
+        size = s;
+        in += s;
+        return true;
+    }
+    //--------------------------------------------------------------------------
+    // maps signed deltas to small unsigned numbers
+    static uint64_t Zigzag(int64_t value){
+        return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    }
+    static int64_t Unzigzag(uint64_t value){
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+    //--------------------------------------------------------------------------
+    // copies size bytes of the argument, false if the input ends before
+    static bool Getbytes(const char *& in, const char * end, void * value,
+                         size_t size){
+        if((size_t)(end - in) < size)
+            return false;
+        memcpy(value, in, size);
+        in += size;
+        return true;
+    }
+    //--------------------------------------------------------------------------
+    // appends the decimal digits of value, two at a time
+    static void Putunsigned(string & out, uint64_t value){
+        static const char pairs[] = 
+            "00010203040506070809101112131415161718192021222324252627282930"
+            "31323334353637383940414243444546474849505152535455565758596061"
+            "62636465666768697071727374757677787980818283848586878889909192"
+            "93949596979899";
+        char digits[20];
+        char * p = digits + sizeof(digits);
+        while(value >= 100){
+            p -= 2;
+            memcpy(p, pairs + 2 * (value % 100), 2);
+            value /= 100;
+        }
+        if(value >= 10){
+            p -= 2;
+            memcpy(p, pairs + 2 * value, 2);
+        }
+        else
+            *--p = (char)('0' + value);
+        out.append(p, digits + sizeof(digits) - p);
+    }
+    //--------------------------------------------------------------------------
+    static void Putsigned(string & out, int64_t value){
+        if(value < 0){
+            out += '-';
+            Putunsigned(out, 0 - (uint64_t)value);
+        }
+        else
+            Putunsigned(out, value);
+    }
+    //--------------------------------------------------------------------------
+    /**
+     * Appends value as printf %.15g does. Values from 1e-4 up to 1e9 with at
+     * most 6 decimals, e.g. prices and latencies, are written digit by digit,
+     * those have at most 15 significant digits, so the text is the same. 
+     * Others go through snprintf.
+     */
+    static void Putdouble(string & out, double value){
+        double scaled = value * 1e6;
+        if(value > -1e9 && value < 1e9 && scaled == (double)(int64_t)scaled){
+            int64_t fixed = (int64_t)scaled;
+            uint64_t magnitude = (fixed < 0) ? 0 - (uint64_t)fixed : fixed;
+            // %g switches to the exponent below 1e-4
+            if(magnitude >= 100 || magnitude == 0){
+                if(std::signbit(value))
+                    out += '-';
+                Putunsigned(out, magnitude / 1000000);
+                unsigned int fraction = magnitude % 1000000;
+                if(fraction == 0)
+                    return;
+                char decimals[7] = { '.' };
+                int n = 6;
+                for(int i = 6; i > 0; i--, fraction /= 10){
+                    decimals[i] = (char)('0' + fraction % 10);
+                    // trailing zeros are dropped
+                    if(decimals[i] == '0' && n == i)
+                        n--;
+                }
+                out.append(decimals, n + 1);
+                return;
+            }
+        }
+        char number[32];
+        out.append(number, snprintf(number, sizeof(number), "%.15g", value));
+    }
+    //--------------------------------------------------------------------------
+    /**
+     * Decodes one argument encoded by QuickLogger::Logf at arg and appends it
+     * to out, advancing arg. With json set the value is written as a JSON 
+     * value: strings and chars quoted and escaped, NaN and infinities as 
+     * null. Returns false if the encoding is unknown or truncated, out is 
+     * left as it was then.
+     */
+    static bool Appendargument(const char *& arg, const char * end, 
+                               string & out, bool json){
+        if(arg >= end)
+            return false;
+        char tag = *arg++;
+        int64_t i;
+        uint64_t u;
+        double d;
+        char c;
+        uint32_t s;
+        switch(tag){
+            case QuickLogger::Argsigned:
+                if(!Getbytes(arg, end, &i, sizeof(i)))
+                    return false;
+                Putsigned(out, i);
+                return true;
+            case QuickLogger::Argunsigned:
+                if(!Getbytes(arg, end, &u, sizeof(u)))
+                    return false;
+                Putunsigned(out, u);
+                return true;
+            case QuickLogger::Argdouble:
+                if(!Getbytes(arg, end, &d, sizeof(d)))
+                    return false;
+                if(json && !std::isfinite(d))
+                    out += "null";
+                else
+                    Putdouble(out, d);
+                return true;
+            case QuickLogger::Argbool:
+                if(!Getbytes(arg, end, &c, sizeof(c)))
+                    return false;
+                out += (c != 0) ? "true" : "false";
+                return true;
+            case QuickLogger::Argchar:
+                if(!Getbytes(arg, end, &c, sizeof(c)))
+                    return false;
+                if(json)
+                    Appendjson(out, &c, 1);
+                else
+                    out += c;
+                return true;
+            case QuickLogger::Argstring:
+                if(!Getbytes(arg, end, &s, sizeof(s)) ||
+                   (uint32_t)(end - arg) < s)
+                    return false;
+                if(json)
+                    Appendjson(out, arg, s);
+                else
+                    out.append(arg, s);
+                arg += s;
+                return true;
+        }
+        return false;
+    }
+    //--------------------------------------------------------------------------
+    /**
+     * Decodes arguments encoded by QuickLogger::Logf and substitutes them for
+     * the {} placeholders of the format. Placeholders without an argument are
+     * written as-is, arguments without a placeholder are ignored.
+     */
+    static void Formatmessage(const char * format, const char * arguments,
+                              size_t size, string & out){
+        const char * arg = arguments;
+        const char * end = arg + size;
+        for(const char * p = format; *p != 0; p++){
+            if(p[0] != '{' || p[1] != '}' || arg >= end){
+                out += *p;
+                continue;
+            }
+            p++;
+            if(Appendargument(arg, end, out, false))
+                continue;
+            // unknown or truncated encoding, nothing else could be decoded
+            arg = end;
+            out += "{}";
+        }
+    }
+    //--------------------------------------------------------------------------
+    /**
+     * Appends key-value fields of a message, encoded as pairs of a string 
+     * name and a value by QuickLogger::Log. As text each field is written as
+     * " name=value", as JSON as ,"name":value - members following the ones
+     * already in the object. Decoding stops at a field which is not valid.
+     */
+    static void Appendfields(const char * fields, size_t size, string & out,
+                             bool json){
+        const char * field = fields;
+        const char * end = fields + size;
+        uint32_t s;
+        while(field < end && *field == QuickLogger::Argstring){
+            const char * name = field + 1;
+            if(!Getbytes(name, end, &s, sizeof(s)) || 
+               (uint32_t)(end - name) < s)
+                return;
+            const char * value = name + s;
+            size_t mark = out.size();
+            if(json){
+                out += ',';
+                Appendjson(out, name, s);
+                out += ':';
+            }
+            else{
+                out += ' ';
+                out.append(name, s);
+                out += '=';
+            }
+            if(!Appendargument(value, end, out, json)){
+                out.resize(mark);
+                return;
+            }
+            field = value;
+        }
+    }
+    //--------------------------------------------------------------------------
+    // characters which make a CSV field need quotes as of RFC 4180: comma,
+    // double quote, CR and LF
+    struct Csvspecial{
+        static bool Is(char c){
+            return c == ',' || c == '"' || c == '\n' || c == '\r';
+        }
+#if defined(__SSE2__)
+        static __m128i Match(__m128i v){
+            return _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')), 
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), 
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        }
+#endif
+#if defined(__AVX2__)
+        static __m256i Match(__m256i v){
+            return _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')), 
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), 
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+        }
+#endif
+    };
+    //--------------------------------------------------------------------------
+    // characters escaped in JSON strings: double quote, backslash and the
+    // control characters below 0x20
+    struct Jsonspecial{
+        static bool Is(char c){
+            return c == '"' || c == '\\' || (unsigned char)c < 0x20;
+        }
+#if defined(__SSE2__)
+        static __m128i Match(__m128i v){
+            __m128i control = _mm_cmpeq_epi8(
+                                  _mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+            return _mm_or_si128(control, _mm_or_si128(
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8('"')), 
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+        }
+#endif
+#if defined(__AVX2__)
+        static __m256i Match(__m256i v){
+            __m256i control = _mm256_cmpeq_epi8(
+                                  _mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v);
+            return _mm256_or_si256(control, _mm256_or_si256(
+                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), 
+                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+        }
+#endif
+    };
+    //--------------------------------------------------------------------------
+    /**
+     * Offset of the first character of data matched by Special, Csvspecial or
+     * Jsonspecial. Returns size if there is none.
+     * Scans 32 bytes at a time if built with AVX2, 16 bytes with SSE2, and 
+     * the last bytes of the field by a vector ending at its end, overlapping
+     * the ones already scanned. Fields shorter than a vector are scanned byte
+     * by byte.
+     */
+    template <typename Special>
+    static size_t Findspecial(const char * data, size_t size){
+        size_t i = 0;
+#if defined(__AVX2__)
+        for(; i + 32 <= size; i += 32){
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+            unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+                                                    Special::Match(v));
+            if(mask != 0)
+                return i + __builtin_ctz(mask);
+        }
+#endif
+#if defined(__SSE2__)
+        if(size >= 16){
+            for(; i + 16 <= size; i += 16){
+                unsigned int mask = Mask16<Special>(data + i);
+                if(mask != 0)
+                    return i + __builtin_ctz(mask);
+            }
+            if(i == size)
+                return size;
+            unsigned int mask = Mask16<Special>(data + size - 16);
+            return (mask != 0) ? size - 16 + __builtin_ctz(mask) : size;
+        }
+#endif
+        for(; i < size; i++){
+            if(Special::Is(data[i]))
+                return i;
+        }
+        return size;
+    }
+#if defined(__SSE2__)
+    //--------------------------------------------------------------------------
+    // bit i set if byte i of the 16 at data is matched by Special
+    template <typename Special>
+    static unsigned int Mask16(const char * data){
+        __m128i v = _mm_loadu_si128((const __m128i *)data);
+        return (unsigned int)_mm_movemask_epi8(Special::Match(v));
+    }
+#endif
+    //--------------------------------------------------------------------------
+    /**
+     * Appends data to out as a JSON string, in quotes, escaping the quotes,
+     * backslashes and control characters. Other bytes are copied as they
+     * are, thus the text is expected to be UTF-8.
+     */
+    static void Appendjson(string & out, const char * data, size_t size){
+        out += '"';
+        for(;;){
+            size_t run = Findspecial<Jsonspecial>(data, size);
+            out.append(data, run);
+            if(run == size)
+                break;
+            unsigned char c = data[run];
+            char escape[6] = { '\\', (char)c };
+            size_t length = 2;
+            switch(c){
+                case '"': case '\\': break;
+                case '\n': escape[1] = 'n'; break;
+                case '\r': escape[1] = 'r'; break;
+                case '\t': escape[1] = 't'; break;
+                case '\b': escape[1] = 'b'; break;
+                case '\f': escape[1] = 'f'; break;
+                default:
+                    memcpy(escape + 1, "u00", 3);
+                    escape[4] = "0123456789abcdef"[c >> 4];
+                    escape[5] = "0123456789abcdef"[c & 0xf];
+                    length = 6;
+            }
+            out.append(escape, length);
+            data += run + 1;
+            size -= run + 1;
+        }
+        out += '"';
+    }
+    //--------------------------------------------------------------------------
+    /**
+     * Quotes the CSV field written to out from offset on, if it needs it,
+     * doubling the quotes inside. Done in place, from the end of the field,
+     * so that fields written straight to the output are not copied again.
+     */
+    static void Quotecsv(string & out, size_t offset){
+        size_t size = out.size() - offset;
+        size_t special = Findspecial<Csvspecial>(out.data() + offset, size);
+        if(special == size)
+            return;
+        size_t quotes = std::count(out.begin() + offset + special, out.end(), 
+                                   '"');
+        out.resize(out.size() + quotes + 2);
+        char * field = &out[offset];
+        size_t to = size + quotes + 1;
+        field[to--] = '"';
+        for(size_t from = size; from-- > 0; ){
+            field[to--] = field[from];
+            if(field[from] == '"')
+                field[to--] = '"';
+        }
+        field[0] = '"';
+    }
+    //--------------------------------------------------------------------------
+    // appends the CSV field to out, quoted if it needs it
+    static void Appendcsv(string & out, const char * data, size_t size){
+        size_t offset = out.size();
+        out.append(data, size);
+        Quotecsv(out, offset);
+    }
+};
+
+#endif	/* QUICKLOGGERCODEC_H */
@@ -0,0 +1,77 @@
+/*
+ * File:   QuickLoggerMacros.h
+ *
+ * Compile-time level filter on top of QuickLogger::Logf. Call sites of the
+ * levels less severe than QL_MIN_LEVEL compile to nothing, their arguments
+ * are not evaluated. Levels which are compiled in are still filtered at run
+ * time, see QuickLogger::Toggleloglevel, before the arguments are evaluated.
+ *
+ *   #define QL_MIN_LEVEL QL_LEVEL_INFO     // before the include, or by -D
+ *   #include "QuickLoggerMacros.h"
+ *   QL_LOG(logger, DEBUG, "depth {}", Depth());    // removed with Depth()
+ *   QL_LOG(logger, INFO, "order {} filled at {}", id, price);
+ *
+ * Levels are the default ones: FATAL, ERROR, WARNING, INFO, DEBUG.
+ */
+
+#ifndef QUICKLOGGERMACROS_H
+#define	QUICKLOGGERMACROS_H
+#include "QuickLogger.h"
+
+// values of QuickLogger::Level, usable in the preprocessor
+#define QL_LEVEL_FATAL   0
+#define QL_LEVEL_ERROR   1
+#define QL_LEVEL_WARNING 2
+#define QL_LEVEL_INFO    3
+#define QL_LEVEL_DEBUG   4
+static_assert((int)QuickLogger::Level::DEBUG == QL_LEVEL_DEBUG,
+              "QL_LEVEL values must follow QuickLogger::Level");
+
+// least severe level compiled in, all levels by default
+#ifndef QL_MIN_LEVEL
+#define QL_MIN_LEVEL QL_LEVEL_DEBUG
+#endif
+
+// constant expression, true if call sites of the level are compiled in
+#define QL_ENABLED(level) (QL_LEVEL_##level <= QL_MIN_LEVEL)
+
+// QuickLogger::Logf of the level, format and arguments follow the logger.
+// Arguments of a level disabled at run time are not evaluated either.
+#define QL_LOG(logger, level, ...) QL_SITE_##level(logger, __VA_ARGS__)
+
+// call site of a level compiled in
+#define QL_SITE(logger, level, ...)                                          \
+    do {                                                                     \
+        if((logger).Enabled<(QuickLogger::Level)QL_LEVEL_##level>())         \
+            (logger).Logf<(QuickLogger::Level)QL_LEVEL_##level>(__VA_ARGS__);\
+    } while(0)
+
+// sites of the levels below QL_MIN_LEVEL are removed by the preprocessor,
+// Logf is not even instantiated for them, whatever the optimization level
+#if QL_ENABLED(FATAL)
+#define QL_SITE_FATAL(logger, ...) QL_SITE(logger, FATAL, __VA_ARGS__)
+#else
+#define QL_SITE_FATAL(logger, ...) ((void)0)
+#endif
+#if QL_ENABLED(ERROR)
+#define QL_SITE_ERROR(logger, ...) QL_SITE(logger, ERROR, __VA_ARGS__)
+#else
+#define QL_SITE_ERROR(logger, ...) ((void)0)
+#endif
+#if QL_ENABLED(WARNING)
+#define QL_SITE_WARNING(logger, ...) QL_SITE(logger, WARNING, __VA_ARGS__)
+#else
+#define QL_SITE_WARNING(logger, ...) ((void)0)
+#endif
+#if QL_ENABLED(INFO)
+#define QL_SITE_INFO(logger, ...) QL_SITE(logger, INFO, __VA_ARGS__)
+#else
+#define QL_SITE_INFO(logger, ...) ((void)0)
+#endif
+#if QL_ENABLED(DEBUG)
+#define QL_SITE_DEBUG(logger, ...) QL_SITE(logger, DEBUG, __VA_ARGS__)
+#else
+#define QL_SITE_DEBUG(logger, ...) ((void)0)
+#endif
+
+#endif	/* QUICKLOGGERMACROS_H */
@@ -0,0 +1,93 @@
+/*
+ * File:   QuickLoggerAllocations.cpp
+ *
+ * Allocation benchmark for the QuickLogger::Log overloads. Replaces the
+ * global operator new to count heap allocations made by the logging thread
+ * and reports allocations, allocated bytes and latency per call for each
+ * way of passing the texts. The message is longer than the small string
+ * buffer of std::string, so that every copy of it allocates.
+ * Build it against an older QuickLogger.cpp to get the numbers before the
+ * change, overloads which do not exist there fall back to Log(string,...).
+ *
+ * Usage: ql_allocations [path] [messages]
+ */
+
+#include "../QuickLogger.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+using namespace std::chrono;
+
+// counts of the calling thread only, the flush thread is not measured
+static thread_local long allocations = 0;
+static thread_local long allocatedbytes = 0;
+
+void * operator new(size_t size){
+    allocations++;
+    allocatedbytes += size;
+    void * p = malloc(size ? size : 1);
+    if(p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void * p) noexcept{
+    free(p);
+}
+void operator delete(void * p, size_t) noexcept{
+    free(p);
+}
+
+template <typename F>
+void Measure(const char * name, long messages, F call){
+    // first calls of a thread register its buffers and grow scratch strings
+    for(int i = 0; i < 100; i++)
+        call();
+    long count = allocations, bytes = allocatedbytes;
+    auto start = steady_clock::now();
+    for(long i = 0; i < messages; i++)
+        call();
+    double elapsed = duration_cast<nanoseconds>(steady_clock::now() -
+                                                start).count();
+    cout << setw(28) << left << name << right
+         << setw(14) << fixed << setprecision(2)
+         << (double)(allocations - count) / messages
+         << setw(14) << setprecision(1)
+         << (double)(allocatedbytes - bytes) / messages
+         << setw(14) << elapsed / messages << endl;
+}
+
+int main(int argc, char ** argv){
+    string path = (argc > 1) ? argv[1] : "/tmp";
+    long messages = (argc > 2) ? atol(argv[2]) : 100000;
+    const char * payload = "order 1234567 filled at 101.25 on venue XNAS";
+    string message = payload, level = "INFO", component = "Bench";
+    QuickLogger logger(path, "allocations", "YMDhms");
+    // large enough to keep the benchmark about the enqueue path only
+    logger.Setbuffersize(5 * (messages + 100));
+    cout << setw(28) << left << "overload" << right << setw(14) << "allocs/call"
+         << setw(14) << "bytes/call" << setw(14) << "ns/call" << endl;
+    Measure("const string &", messages, [&]{
+        logger.Log(message, level, component);
+    });
+    Measure("const char *", messages, [&]{
+        logger.Log(payload, "INFO", "Bench");
+    });
+    // building the temporary message allocates once, Log itself does not
+    Measure("temporary string", messages, [&]{
+        logger.Log(string(payload), string("INFO"), string("Bench"));
+    });
+#if __cplusplus >= 201703L
+    std::string_view view(payload);
+    Measure("string_view", messages, [&]{
+        logger.Log(view, std::string_view("INFO"), std::string_view("Bench"));
+    });
+#endif
+    Measure("Logf", messages, [&]{
+        logger.Logf<QuickLogger::Level::INFO>("order {} filled at {}",
+                                              1234567, 101.25);
+    });
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * File:   QuickLoggerBench.cpp
+ *
+ * Benchmark suite for the figures given in QuickLogger.h: Log latency and
+ * messages per second without buffer overflows. For 1 to 64 producer
+ * threads it runs two phases on a fresh logger:
+ *  burst - every thread logs its messages as fast as it can
+ *  paced - threads together log at the given rate for one second
+ * and reports per-call latency percentiles, throughput of the producers,
+ * sustained throughput up to the last message written, overflow rate and
+ * the lag between a message being logged and written. Lag is measured by
+ * polling Getstats, thus its resolution is the polling period of 200 us.
+ * Results are printed as JSON, so that runs can be compared by scripts.
+ *
+ * Usage: ql_bench [path] [messages per thread] [buffer size]
+ *                 [flush frequency in ms] [paced rate in messages/s, 0 skips]
+ */
+
+#include "../QuickLogger.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+using namespace std::chrono;
+
+struct Settings{
+    string path;
+    long messages;
+    unsigned int buffersize;
+    unsigned int flushfrequency;
+    long rate;
+};
+
+// counters of the logger at a point in time
+struct Sample{
+    steady_clock::time_point time;
+    long enqueued;
+    long written;
+};
+
+// value at the fraction of the sorted values
+template <typename T>
+static T Percentile(const vector<T> & sorted, double fraction){
+    if(sorted.empty())
+        return 0;
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+/**
+ * Lag of each written message, in microseconds. Message number n is taken
+ * as logged at the first sample with n enqueued messages and as written at
+ * the first sample with n written ones.
+ */
+static vector<long> Flushlags(const vector<Sample> & samples){
+    vector<long> lags;
+    long written = 0;
+    for(auto i = samples.begin(); i != samples.end(); i++){
+        if((*i).written <= written)
+            continue;
+        auto logged = std::lower_bound(samples.begin(), i + 1, (*i).written,
+                                       [](const Sample & s, long n){
+            return s.enqueued < n;
+        });
+        // messages stored and written between the two counter loads
+        if(logged > i)
+            logged = i;
+        long lag = duration_cast<microseconds>((*i).time -
+                                               (*logged).time).count();
+        // one entry per message written since the previous sample
+        lags.insert(lags.end(), (*i).written - written, lag);
+        written = (*i).written;
+    }
+    std::sort(lags.begin(), lags.end());
+    return lags;
+}
+
+static string Run(const Settings & settings, unsigned int threads,
+                  bool paced){
+    QuickLogger logger(settings.path, "bench", "YMDhms");
+    logger.Setbuffersize(settings.buffersize);
+    logger.Setflushfrequency(settings.flushfrequency);
+    long messages = paced ? std::max(settings.rate / threads, 1L) :
+                            settings.messages;
+    // paced threads together log settings.rate messages per second
+    nanoseconds period(paced ? 1000000000L * threads / settings.rate : 0);
+    string payload = "order 1234567 filled at 101.25 on venue XNAS";
+    std::atomic<bool> go(false);
+    std::atomic<unsigned int> running(threads);
+    vector<vector<uint32_t>> latencies(threads);
+    vector<std::thread> producers;
+    for(unsigned int t = 0; t < threads; t++){
+        producers.push_back(std::thread([&, t](){
+            vector<uint32_t> & latency = latencies[t];
+            latency.reserve(messages);
+            while(!go.load())
+                std::this_thread::yield();
+            auto next = steady_clock::now();
+            for(long i = 0; i < messages; i++){
+                if(paced){
+                    next += period;
+                    std::this_thread::sleep_until(next);
+                }
+                auto start = steady_clock::now();
+                logger.Log(payload, "INFO", "Bench");
+                latency.push_back(duration_cast<nanoseconds>(
+                                  steady_clock::now() - start).count());
+            }
+            running--;
+        }));
+    }
+    // counters are polled until every stored message is written
+    vector<Sample> samples;
+    samples.reserve(1 << 16);
+    auto start = steady_clock::now();
+    go.store(true);
+    steady_clock::time_point produced;
+    bool done = false;
+    while(true){
+        QuickLogger::Stats stats = logger.Getstats();
+        Sample sample = { steady_clock::now(), stats.enqueued, stats.written };
+        samples.push_back(sample);
+        if(!done && running.load() == 0){
+            done = true;
+            produced = sample.time;
+            continue;
+        }
+        if(done && sample.written >= sample.enqueued)
+            break;
+        // flush thread could be stuck, the run is reported as it is
+        if(done && sample.time - produced > seconds(10))
+            break;
+        std::this_thread::sleep_for(microseconds(200));
+    }
+    for(auto i = producers.begin(); i != producers.end(); i++)
+        (*i).join();
+    vector<uint32_t> latency;
+    for(auto i = latencies.begin(); i != latencies.end(); i++)
+        latency.insert(latency.end(), (*i).begin(), (*i).end());
+    std::sort(latency.begin(), latency.end());
+    vector<long> lags = Flushlags(samples);
+    long total = (long)threads * messages;
+    long overflows = logger.Getoverflowcounters("INFO").overflows;
+    double producing = duration_cast<nanoseconds>(produced - start).count();
+    double writing = duration_cast<nanoseconds>(samples.back().time -
+                                                start).count();
+    std::ostringstream json;
+    json << "{\"threads\": " << threads
+         << ", \"mode\": \"" << (paced ? "paced" : "burst") << "\""
+         << ", \"messages\": " << total
+         << ", \"latency_ns\": {\"p50\": " << Percentile(latency, 0.5)
+         << ", \"p99\": " << Percentile(latency, 0.99)
+         << ", \"p99.9\": " << Percentile(latency, 0.999)
+         << ", \"max\": " << (latency.empty() ? 0 : latency.back()) << "}"
+         << ", \"throughput_msgs\": " << (long)(total / producing * 1e9)
+         << ", \"sustained_msgs\": "
+         << (long)(samples.back().written / writing * 1e9)
+         << ", \"overflows\": " << overflows
+         << ", \"overflow_rate\": " << (double)overflows / total
+         << ", \"flush_lag_us\": {\"p50\": " << Percentile(lags, 0.5)
+         << ", \"p99\": " << Percentile(lags, 0.99)
+         << ", \"max\": " << (lags.empty() ? 0 : lags.back()) << "}}";
+    return json.str();
+}
+
+int main(int argc, char ** argv){
+    Settings settings;
+    settings.path = (argc > 1) ? argv[1] : "/tmp";
+    settings.messages = (argc > 2) ? atol(argv[2]) : 20000;
+    settings.buffersize = (argc > 3) ? atoi(argv[3]) : 1000;
+    settings.flushfrequency = (argc > 4) ? atoi(argv[4]) : 10;
+    settings.rate = (argc > 5) ? atol(argv[5]) : 35000;
+    cout << "{\"benchmark\": \"ql_bench\""
+         << ", \"messages_per_thread\": " << settings.messages
+         << ", \"buffersize\": " << settings.buffersize
+         << ", \"flushfrequency_ms\": " << settings.flushfrequency
+         << ", \"paced_rate\": " << settings.rate
+         << ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+         << ",\n \"results\": [";
+    string separator = "\n  ";
+    for(unsigned int threads = 1; threads <= 64; threads *= 2){
+        cout << separator << Run(settings, threads, false) << flush;
+        separator = ",\n  ";
+        if(settings.rate > 0)
+            cout << separator << Run(settings, threads, true) << flush;
+    }
+    cout << "\n]}" << endl;
+    return 0;
+}
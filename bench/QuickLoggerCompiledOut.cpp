@@ -0,0 +1,69 @@
+/*
+ * File:   QuickLoggerCompiledOut.cpp
+ *
+ * Cost of the QL_LOG call sites, built with QL_MIN_LEVEL of INFO. Compares
+ * an empty loop with DEBUG sites, which are compiled out, INFO sites of a
+ * level disabled by Toggleloglevel and enabled INFO sites. Argument of each
+ * site is a call counting its evaluations, it must stay 0 unless the site
+ * is enabled.
+ *
+ * Usage: ql_compiledout [path] [iterations]
+ */
+
+#define QL_MIN_LEVEL QL_LEVEL_INFO
+#include "../QuickLoggerMacros.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std::chrono;
+
+static long evaluations = 0;
+
+// not inlined, so that an evaluated argument always costs a call
+__attribute__((noinline)) static long Argument(long i){
+    evaluations++;
+    return i * 3;
+}
+
+template <typename F>
+void Measure(const char * name, long iterations, F site){
+    evaluations = 0;
+    auto start = steady_clock::now();
+    for(long i = 0; i < iterations; i++){
+        site(i);
+        // keeps the loop from being removed as a whole
+        asm volatile("" ::: "memory");
+    }
+    double elapsed = duration_cast<nanoseconds>(steady_clock::now() -
+                                                start).count();
+    cout << setw(24) << left << name << right
+         << setw(14) << fixed << setprecision(2) << elapsed / iterations
+         << setw(14) << evaluations << endl;
+}
+
+int main(int argc, char ** argv){
+    string path = (argc > 1) ? argv[1] : "/tmp";
+    long iterations = (argc > 2) ? atol(argv[2]) : 10000000;
+    QuickLogger logger(path, "compiledout", "YMDhms");
+    cout << setw(24) << left << "site" << right << setw(14) << "ns/call"
+         << setw(14) << "evaluations" << endl;
+    Measure("empty loop", iterations, [&](long){ });
+    Measure("DEBUG, compiled out", iterations, [&](long i){
+        QL_LOG(logger, DEBUG, "depth {} at {}", Argument(i), 101.25);
+    });
+    logger.Toggleloglevel("INFO", false);
+    Measure("INFO, disabled", iterations, [&](long i){
+        QL_LOG(logger, INFO, "depth {} at {}", Argument(i), 101.25);
+    });
+    logger.Toggleloglevel("INFO", true);
+    // large enough to keep the enabled sites about the enqueue path only
+    long enabled = std::min(iterations, 100000L);
+    logger.Setbuffersize(enabled + 100);
+    Measure("INFO, enabled", enabled, [&](long i){
+        QL_LOG(logger, INFO, "depth {} at {}", Argument(i), 101.25);
+    });
+    cout << "overflows " << logger.Getbufferoverflows() << endl;
+    return 0;
+}
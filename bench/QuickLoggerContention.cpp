@@ -0,0 +1,60 @@
+/* 
+ * File:   QuickLoggerContention.cpp
+ *
+ * Contention benchmark for QuickLogger::Log. Spawns 1 to 64 producer threads
+ * which log into the same logger and reports per-call latency, aggregate
+ * throughput and buffer overflows for every thread count.
+ *
+ * Usage: ql_contention [path] [messages per thread]
+ */
+
+#include "../QuickLogger.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std::chrono;
+
+int main(int argc, char ** argv){
+    string path = (argc > 1) ? argv[1] : "/tmp";
+    long messages = (argc > 2) ? atol(argv[2]) : 100000;
+    string payload = "order 1234567 filled at 101.25 on venue XNAS";
+    cout << setw(8) << "threads" << setw(14) << "ns/call" 
+         << setw(14) << "Mmsg/s" << setw(14) << "overflows" << endl;
+    for(unsigned int threads = 1; threads <= 64; threads *= 2){
+        QuickLogger logger(path, "contention", "YMDhms");
+        // large enough to keep the benchmark about the enqueue path only
+        logger.Setbuffersize(threads * messages);
+        std::atomic<bool> go(false);
+        std::atomic<long> busy(0);
+        vector<std::thread> producers;
+        for(unsigned int t = 0; t < threads; t++){
+            producers.push_back(std::thread([&](){
+                while(!go.load())
+                    std::this_thread::yield();
+                auto start = steady_clock::now();
+                for(long i = 0; i < messages; i++)
+                    logger.Log(payload, "INFO", "Bench");
+                busy += duration_cast<nanoseconds>(steady_clock::now() - 
+                                                   start).count();
+            }));
+        }
+        auto start = steady_clock::now();
+        go.store(true);
+        for(auto i = producers.begin(); i != producers.end(); i++)
+            (*i).join();
+        double elapsed = duration_cast<nanoseconds>(steady_clock::now() - 
+                                                    start).count();
+        cout << setw(8) << threads 
+             << setw(14) << fixed << setprecision(1) 
+             << (double)busy.load() / (threads * messages)
+             << setw(14) << setprecision(3)
+             << (threads * messages) / elapsed * 1000.0
+             << setw(14) << logger.Getbufferoverflows() << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ * File:   QuickLoggerStress.cpp
+ *
+ * Stress test of the QuickLogger threads, meant to be built with
+ * -fsanitize=thread (cmake -DQL_TSAN=ON). Producer threads log while other
+ * threads read the stats and the file name, resize the buffer and change the
+ * configuration, for every overflow policy, with shared, per-thread and
+ * toggled buffers, with and without the shared backend. Files are rolled
+ * over by size meanwhile. Once the logger is destroyed its files are read
+ * back: every message has to be either written or counted as dropped.
+ * Empty phases log messages without any text, e.g. Logf without arguments,
+ * into a buffer which never fills up, none of them may be dropped.
+ * Newest phases overflow a small buffer with DROPOLDEST while the flush
+ * thread is stuck writing to a pipe, the last message has to be written.
+ * Exits with 1 if any phase loses or duplicates messages.
+ *
+ * Usage: ql_stress [path] [messages per thread]
+ */
+
+#include "../QuickLogger.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const unsigned int producers = 4;
+static const char * policynames[] = {
+    "DROPNEWEST", "DROPOLDEST", "BLOCK", "SPIN", "SAMPLE"
+};
+static const char * buffernames[] = { "shared", "thread", "toggled" };
+static const char * levels[] = { "FATAL", "ERROR", "WARNING", "INFO", "DEBUG" };
+
+// counts the lines of the files of the logger containing any of the markers
+// and removes the files
+static long Countmessages(const string & path, const string & prefix,
+                          const vector<string> & markers){
+    DIR * dir = opendir(path.c_str());
+    if(dir == nullptr)
+        return -1;
+    long count = 0;
+    struct dirent * entry;
+    while((entry = readdir(dir)) != nullptr){
+        string file = entry->d_name;
+        if(file.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        file = path + "/" + file;
+        ifstream in(file.c_str());
+        string line;
+        while(getline(in, line))
+            for(auto i = markers.begin(); i != markers.end(); i++)
+                if(line.find(*i) != string::npos){
+                    count++;
+                    break;
+                }
+        in.close();
+        unlink(file.c_str());
+    }
+    closedir(dir);
+    return count;
+}
+
+static void Produce(QuickLogger & logger, unsigned int thread, long messages){
+    for(long i = 0; i < messages; i++){
+        switch(i % 4){
+        case 0:
+            logger.Log("stress " + to_string(thread) + " " + to_string(i),
+                       levels[1 + i / 4 % 4], "Stress");
+            break;
+        case 1:
+            logger.Logf<QuickLogger::Level::INFO>("stress {} {}", thread, i);
+            break;
+        case 2:
+            logger.Log("stress fields", "DEBUG", "Stress",
+                       {{"thread", thread}, {"i", i}});
+            break;
+        case 3:
+            logger.Log("stress plain", "WARNING");
+            break;
+        }
+    }
+}
+
+static bool Report(unsigned int phase, const char * policy, int buffers,
+                   unsigned int backend, long logged, long written,
+                   long dropped, bool ok){
+    cout << setw(6) << phase << setw(12) << policy
+         << setw(9) << buffernames[buffers] << setw(9) << backend
+         << setw(10) << logged << setw(10) << written
+         << setw(10) << dropped << setw(6) << (ok ? "ok" : "FAIL") << endl;
+    return ok;
+}
+
+static bool Run(const string & path, unsigned int phase,
+                QuickLogger::Overflow policy, int buffers,
+                unsigned int backend, long messages){
+    string name = "stress" + to_string(phase);
+    long dropped = 0;
+    {
+        QuickLogger logger(path, name, "YMDhms", "",
+                           phase % 2 ? QuickLogger::Format::JSONL :
+                                       QuickLogger::Format::CSV);
+        logger.Setsink((QuickLogger::Sinktype)(phase % 3), false, 1 << 20);
+        logger.Setmaxfilesize(256 << 10);
+        logger.Setoverflowpolicy(policy,
+                                 policy == QuickLogger::Overflow::SAMPLE ?
+                                 25 : 0);
+        logger.Setthreadbuffers(buffers == 1);
+        logger.Setbuffersize(256);
+        std::atomic<bool> running(true);
+        vector<std::thread> threads;
+        for(unsigned int t = 0; t < producers; t++)
+            threads.push_back(std::thread(Produce, std::ref(logger), t,
+                                          messages));
+        // readers
+        std::thread drain([&](){
+            while(running.load()){
+                logger.Getstats();
+                logger.Getbufferoverflows();
+                logger.Getoverflowcounters("INFO");
+                logger.Getwritesperdrain();
+                logger.Getfilename();
+                std::this_thread::yield();
+            }
+        });
+        // reconfiguration
+        std::thread configure([&](){
+            for(unsigned int k = 0; running.load(); k++){
+                logger.Setbuffersize(k % 2 ? 64 : 1024);
+                logger.Setflushfrequency(1 + k % 5);
+                logger.Setflushtrigger(k % 2 ? 16 : 500, k % 3 ? 0 : 50);
+                logger.Setbatching(k % 2 ? 512 : 65536, k % 3 != 0);
+                logger.Setfields(k % 2 ? "TIME,LEVEL,MESSAGE" :
+                                         "TIME,LEVEL,COMPONENT,MESSAGE");
+                if(buffers == 2)
+                    logger.Setthreadbuffers(k % 2 == 0);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        for(unsigned int t = 0; t < producers; t++)
+            threads[t].join();
+        running.store(false);
+        drain.join();
+        configure.join();
+        // messages are dropped by the producers only, counters are final
+        for(int i = 0; i < 5; i++){
+            QuickLogger::Overflowcounters counters =
+                logger.Getoverflowcounters(levels[i]);
+            dropped += counters.overflows + counters.sampled;
+        }
+    }
+    long logged = producers * messages;
+    long written = Countmessages(path, "QL_" + name + "_", {"stress "});
+    return Report(phase, policynames[(int)policy], buffers, backend, logged,
+                  written, dropped, written + dropped == logged);
+}
+
+// messages without text take no bytes of the arena, they are interleaved
+// with the others so that they land at the tail of a non-empty arena
+static void Produceempty(QuickLogger & logger, QuickLogger::Channel channel,
+                         unsigned int thread, long messages){
+    for(long i = 0; i < messages; i++){
+        switch(i % 4){
+        case 0:
+            logger.Log("", "FATAL");
+            break;
+        case 1:
+            logger.Logf<QuickLogger::Level::INFO>("no args");
+            break;
+        case 2:
+            channel.Log("");
+            break;
+        case 3:
+            logger.Log("stress " + to_string(thread) + " " + to_string(i),
+                       "DEBUG", "Stress");
+            break;
+        }
+    }
+}
+
+static bool Runempty(const string & path, unsigned int phase, int buffers,
+                     unsigned int backend, long messages){
+    string name = "stress" + to_string(phase);
+    long logged = producers * messages;
+    long dropped = 0;
+    {
+        QuickLogger logger(path, name, "YMDhms");
+        logger.Setthreadbuffers(buffers == 1);
+        logger.Setbuffersize(logged);
+        QuickLogger::Channel channel = logger.Getchannel("Empty", "WARNING");
+        vector<std::thread> threads;
+        for(unsigned int t = 0; t < producers; t++)
+            threads.push_back(std::thread(Produceempty, std::ref(logger),
+                                          channel, t, messages));
+        for(unsigned int t = 0; t < producers; t++)
+            threads[t].join();
+        for(int i = 0; i < 5; i++){
+            QuickLogger::Overflowcounters counters =
+                logger.Getoverflowcounters(levels[i]);
+            dropped += counters.overflows + counters.sampled;
+        }
+    }
+    long written = Countmessages(path, "QL_" + name + "_",
+                                 {"FATAL", "no args", "Empty", "stress "});
+    return Report(phase, "empty", buffers, backend, logged, written, dropped,
+                  dropped == 0 && written == logged);
+}
+
+// file of the logger is a pipe which is not read for a while, thus the flush
+// thread blocks in a write, holding the messages it claimed. Buffer is filled
+// up behind them with DROPOLDEST: the last message has to be stored once the
+// flush thread releases its messages, nothing could drop it afterwards.
+static bool Runnewest(const string & path, unsigned int phase, int buffers,
+                      unsigned int backend){
+    string name = "stress" + to_string(phase);
+    // empty time format gives a fixed file name
+    string file = path + "/QL_" + name + "_.log.csv";
+    unlink(file.c_str());
+    if(mkfifo(file.c_str(), 0644) != 0)
+        return Report(phase, "newest", buffers, backend, 1, 0, 0, false);
+    std::atomic<bool> resume(false);
+    long written = 0, dropped = 0;
+    std::thread reader([&](){
+        ifstream in(file.c_str());
+        while(!resume.load())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        string line;
+        while(getline(in, line))
+            if(line.find("newest") != string::npos)
+                written++;
+    });
+    {
+        QuickLogger logger(path, name, "");
+        logger.Setthreadbuffers(buffers == 1);
+        logger.Setbuffersize(64);
+        // a write per message, the claimed batch is held while it blocks
+        logger.Setbatching(1);
+        // fills the pipe and the buffer without waiting for the flush thread
+        for(long i = 0; i < 20000; i++)
+            logger.Log("stress " + to_string(i), "DEBUG", "Stress");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        logger.Setoverflowpolicy(QuickLogger::Overflow::DROPOLDEST, 1000000);
+        resume.store(true);
+        for(long i = 0; i < 256; i++)
+            logger.Log("stress " + to_string(i), "DEBUG", "Stress");
+        logger.Log("newest", "DEBUG", "Stress");
+        dropped = logger.Getoverflowcounters("DEBUG").overflows;
+    }
+    reader.join();
+    unlink(file.c_str());
+    return Report(phase, "newest", buffers, backend, 1, written, dropped,
+                  written == 1);
+}
+
+int main(int argc, char ** argv){
+    string path = (argc > 1) ? argv[1] : "/tmp";
+    long messages = (argc > 2) ? atol(argv[2]) : 10000;
+    cout << setw(6) << "phase" << setw(12) << "policy" << setw(9) << "buffers"
+         << setw(9) << "backend" << setw(10) << "logged" << setw(10)
+         << "written" << setw(10) << "dropped" << setw(6) << "" << endl;
+    bool ok = true;
+    unsigned int phase = 0;
+    for(unsigned int backend = 0; backend <= 2; backend += 2){
+        QuickLogger::Setbackend(backend);
+        for(int policy = 0; policy < 5; policy++)
+            for(int buffers = 0; buffers < 3; buffers++)
+                ok &= Run(path, phase++, (QuickLogger::Overflow)policy,
+                          buffers, backend, messages);
+        for(int buffers = 0; buffers < 2; buffers++)
+            ok &= Runempty(path, phase++, buffers, backend, messages);
+        for(int buffers = 0; buffers < 2; buffers++)
+            ok &= Runnewest(path, phase++, buffers, backend);
+    }
+    QuickLogger::Setbackend(0);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,7 @@
+#!/bin/bash
+g++ -O2 -std=c++11 -pthread -o ql_bench bench/QuickLoggerBench.cpp QuickLogger.cpp
+g++ -O2 -std=c++11 -pthread -o ql_contention bench/QuickLoggerContention.cpp QuickLogger.cpp
+g++ -O2 -std=c++11 -pthread -o ql_allocations bench/QuickLoggerAllocations.cpp QuickLogger.cpp
+g++ -O2 -std=c++11 -pthread -o ql_compiledout bench/QuickLoggerCompiledOut.cpp QuickLogger.cpp
+# ThreadSanitizer build of the stress test, run ./ql_stress /tmp
+g++ -O1 -g -std=c++11 -pthread -fsanitize=thread -o ql_stress bench/QuickLoggerStress.cpp QuickLogger.cpp
@@ -1,4 +1,9 @@
 #!/bin/bash
    #-m64
+# add -DQL_WITH_ZLIB (link with -lz) or -DQL_WITH_ZSTD (-lzstd) to compress
+# rolled over files
+# add -mavx2 to scan CSV fields for quoting 32 bytes at a time, SSE2 is used
+# otherwise on x86-64
 g++  -Wl,--no-as-needed -c -O2 -s -std=c++11  -o QuickLogger.o QuickLogger.cpp
-ar -rv libquicklogger.a QuickLogger.o
\ No newline at end of file
+ar -rv libquicklogger.a QuickLogger.o
+g++  -O2 -s -std=c++11 -o ql-decode tools/QuickLoggerDecode.cpp
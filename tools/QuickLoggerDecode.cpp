@@ -0,0 +1,275 @@
+/* 
+ * File:   QuickLoggerDecode.cpp
+ * Author: hitman
+ *
+ * ql-decode - converts files written with QuickLogger::Format::BINARY back to
+ * CSV, or JSON Lines as QuickLogger::Format::JSONL writes them, in the field
+ * order the file was written with.
+ *
+ * Usage: ql-decode [--jsonl] [file ...]
+ *   Decodes the files one after another to the standard output. Standard
+ *   input is decoded if no file is given.
+ */
+
+#include "../QuickLoggerCodec.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <ctime>
+
+class Decoder {
+public:
+    Decoder(bool json) : json(json), lasttimestamp(0), second(-1) { };
+    // decodes the stream, returns false if it is corrupted or truncated
+    bool Decode(istream & in, ostream & out);
+private:
+    // JSON Lines output instead of CSV
+    bool json;
+    std::vector<int> fieldorder;
+    std::vector<string> levels;
+    std::vector<string> components;
+    std::vector<string> formats;
+    uint64_t lasttimestamp;
+    // second the date prefix was rendered for
+    time_t second;
+    char prefix[32];
+    string line;
+    // JSON value rendered before it is escaped
+    string text;
+    // decodes one record, returns 0 if the record is incomplete,
+    // -1 if it is corrupted, size of the record otherwise
+    long Record(const char * begin, const char * end, ostream & out);
+    // stores definition in the dictionary
+    static void Define(std::vector<string> & dictionary, uint64_t id,
+                       const char * value, size_t size);
+    // looks up the dictionary, empty string for unknown ids
+    static const string & Lookup(const std::vector<string> & dictionary,
+                                 uint64_t id);
+    // renders timestamp as Y-M-D h:m:s.l
+    void Time(uint64_t timestamp, string & out);
+    // renders the message as a JSONL object
+    void Json(char type, uint64_t level, uint64_t component, uint64_t format,
+              const char * value, size_t size, const char * fields, 
+              size_t fieldssize);
+};
+//--------------------------------------------------------------------------
+bool Decoder::Decode(istream & in, ostream & out){
+    std::vector<char> buffer(1 << 20);
+    size_t size = 0;
+    while(in){
+        if(size == buffer.size())
+            buffer.resize(buffer.size() * 2);
+        in.read(&buffer[size], buffer.size() - size);
+        size += in.gcount();
+        const char * p = buffer.data();
+        const char * end = p + size;
+        long n = 0;
+        while(p < end && (n = this->Record(p, end, out)) > 0)
+            p += n;
+        if(n < 0){
+            cerr << "Corrupted record" << endl;
+            return false;
+        }
+        // keep the incomplete record for the next read
+        size = end - p;
+        std::copy(p, end, buffer.begin());
+    }
+    if(size > 0){
+        cerr << "Truncated record at the end of the file" << endl;
+        return false;
+    }
+    return true;
+}
+//--------------------------------------------------------------------------
+long Decoder::Record(const char * begin, const char * end, ostream & out){
+    const char * p = begin + 1;
+    uint64_t id, delta, level, component, format = 0, count;
+    const char * value, * fields = nullptr;
+    size_t size, fieldssize = 0;
+    switch(*begin){
+        case QuickLoggerCodec::Padding:
+            return 1;
+        case QuickLoggerCodec::Header:
+            if(end - p < 4)
+                return 0;
+            if(string(p, 3) != "QLB" || p[3] < 1 || 
+               p[3] > QuickLoggerCodec::version)
+                return -1;
+            p += 4;
+            if(!QuickLoggerCodec::Getvarint(p, end, count))
+                return 0;
+            this->fieldorder.clear();
+            for(uint64_t i = 0; i < count; i++){
+                if(!QuickLoggerCodec::Getvarint(p, end, id))
+                    return 0;
+                this->fieldorder.push_back(id);
+            }
+            this->levels.clear();
+            this->components.clear();
+            this->formats.clear();
+            this->lasttimestamp = 0;
+            return p - begin;
+        case QuickLoggerCodec::Leveldefinition:
+        case QuickLoggerCodec::Componentdefinition:
+        case QuickLoggerCodec::Formatdefinition:
+            if(!QuickLoggerCodec::Getvarint(p, end, id) ||
+               !QuickLoggerCodec::Getstring(p, end, value, size))
+                return 0;
+            Define((*begin == QuickLoggerCodec::Leveldefinition) ? levels :
+                   (*begin == QuickLoggerCodec::Componentdefinition) ? 
+                   components : formats, id, value, size);
+            return p - begin;
+        case QuickLoggerCodec::Message:
+        case QuickLoggerCodec::Formattedmessage:
+        case QuickLoggerCodec::Fieldsmessage:
+            if(!QuickLoggerCodec::Getvarint(p, end, delta) ||
+               !QuickLoggerCodec::Getvarint(p, end, level) ||
+               !QuickLoggerCodec::Getvarint(p, end, component))
+                return 0;
+            if(*begin == QuickLoggerCodec::Formattedmessage &&
+               !QuickLoggerCodec::Getvarint(p, end, format))
+                return 0;
+            if(!QuickLoggerCodec::Getstring(p, end, value, size))
+                return 0;
+            if(*begin == QuickLoggerCodec::Fieldsmessage &&
+               !QuickLoggerCodec::Getstring(p, end, fields, fieldssize))
+                return 0;
+            break;
+        default:
+            return -1;
+    }
+    this->lasttimestamp += QuickLoggerCodec::Unzigzag(delta);
+    this->line.clear();
+    if(this->json){
+        this->Json(*begin, level, component, format, value, size, fields, 
+                   fieldssize);
+        out.write(this->line.data(), this->line.size());
+        return p - begin;
+    }
+    for(auto i = fieldorder.begin(); i != fieldorder.end(); i++){
+        switch(*i){
+            case 0:
+                this->Time(this->lasttimestamp, this->line);
+                break;
+            case 1:{
+                const string & name = Lookup(this->levels, level);
+                QuickLoggerCodec::Appendcsv(this->line, name.data(), 
+                                            name.size());
+                break;
+            }
+            case 2:{
+                const string & name = Lookup(this->components, component);
+                QuickLoggerCodec::Appendcsv(this->line, name.data(), 
+                                            name.size());
+                break;
+            }
+            case 3:{
+                size_t offset = this->line.size();
+                if(*begin == QuickLoggerCodec::Formattedmessage)
+                    QuickLoggerCodec::Formatmessage(
+                            Lookup(this->formats, format).c_str(), 
+                            value, size, this->line);
+                else
+                    this->line.append(value, size);
+                QuickLoggerCodec::Appendfields(fields, fieldssize, this->line,
+                                               false);
+                QuickLoggerCodec::Quotecsv(this->line, offset);
+                break;
+            }
+        }
+        if(std::next(i) != fieldorder.end())
+            this->line += ',';
+    }
+    this->line += '\n';
+    out.write(this->line.data(), this->line.size());
+    return p - begin;
+}
+//--------------------------------------------------------------------------
+void Decoder::Json(char type, uint64_t level, uint64_t component, 
+                   uint64_t format, const char * value, size_t size,
+                   const char * fields, size_t fieldssize){
+    char separator = '{';
+    for(auto i = fieldorder.begin(); i != fieldorder.end(); i++){
+        this->line += separator;
+        separator = ',';
+        this->text.clear();
+        switch(*i){
+            case 0:
+                this->line += "\"time\":";
+                this->Time(this->lasttimestamp, this->text);
+                break;
+            case 1:
+                this->line += "\"level\":";
+                this->text = Lookup(this->levels, level);
+                break;
+            case 2:
+                this->line += "\"component\":";
+                this->text = Lookup(this->components, component);
+                break;
+            case 3:
+                this->line += "\"message\":";
+                if(type == QuickLoggerCodec::Formattedmessage)
+                    QuickLoggerCodec::Formatmessage(
+                            Lookup(this->formats, format).c_str(), 
+                            value, size, this->text);
+                else
+                    this->text.assign(value, size);
+                break;
+        }
+        QuickLoggerCodec::Appendjson(this->line, this->text.data(), 
+                                     this->text.size());
+    }
+    QuickLoggerCodec::Appendfields(fields, fieldssize, this->line, true);
+    this->line += "}\n";
+}
+//--------------------------------------------------------------------------
+void Decoder::Define(std::vector<string> & dictionary, uint64_t id,
+                     const char * value, size_t size){
+    if(id >= dictionary.size())
+        dictionary.resize(id + 1);
+    dictionary[id].assign(value, size);
+}
+//--------------------------------------------------------------------------
+const string & Decoder::Lookup(const std::vector<string> & dictionary,
+                               uint64_t id){
+    static const string unknown;
+    return (id < dictionary.size()) ? dictionary[id] : unknown;
+}
+//--------------------------------------------------------------------------
+void Decoder::Time(uint64_t timestamp, string & out){
+    time_t second = timestamp / 1000000;
+    char micro[8];
+    if(second != this->second){
+        tm now;
+        localtime_r(&second, &now);
+        strftime(this->prefix, sizeof(this->prefix), "%Y-%m-%d %H:%M:%S", 
+                 &now);
+        this->second = second;
+    }
+    snprintf(micro, sizeof(micro), ".%06u", (unsigned)(timestamp % 1000000));
+    out += this->prefix;
+    out += micro;
+}
+//--------------------------------------------------------------------------
+int main(int argc, char ** argv){
+    std::ios::sync_with_stdio(false);
+    bool ok = true;
+    bool json = argc > 1 && string(argv[1]) == "--jsonl";
+    int first = json ? 2 : 1;
+    if(argc <= first){
+        Decoder decoder(json);
+        ok = decoder.Decode(cin, cout);
+    }
+    for(int i = first; i < argc; i++){
+        ifstream in(argv[i], ios::binary);
+        if(!in){
+            cerr << "Failed to open file " << argv[i] << endl;
+            ok = false;
+            continue;
+        }
+        Decoder decoder(json);
+        ok = decoder.Decode(in, cout) && ok;
+    }
+    return ok ? 0 : 1;
+}